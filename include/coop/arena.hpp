@@ -0,0 +1,140 @@
+#pragma once
+
+#include "detail/api.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace coop
+{
+// A thread-safe bump allocator for the coroutine frames of a task tree. A
+// coroutine started with `std::allocator_arg` and an arena as its leading
+// parameters (following the object parameter for member functions and
+// lambdas) allocates its frame from the arena. Arenas aren't inherited, so
+// each coroutine in the tree is passed the arena the same way:
+//
+//     coop::task_t<int> parse(std::allocator_arg_t, coop::arena_t&, request_t const& request);
+//
+//     coop::task_t<void, true> handle_request(std::allocator_arg_t, coop::arena_t& arena, request_t request)
+//     {
+//         int length = co_await parse(std::allocator_arg, arena, request);
+//         ...
+//     }
+//
+//     coop::arena_t arena;
+//     handle_request(std::allocator_arg, arena, std::move(request)).join();
+//
+// A task spawned within the tree without the arena (e.g. a background task
+// that outlives the request) allocates from the usual frame pools instead.
+//
+// Frames in an arena are not freed individually when their coroutines
+// complete. Instead, the arena counts its live frames and releases all of its
+// memory at once when the last of them is freed, which is typically when the
+// root of the tree completes. A frame that outlives the root keeps the memory
+// alive until it's freed in turn. The arena may then be reused for another
+// tree, and must outlive every frame allocated from it.
+class COOP_API arena_t
+{
+public:
+    // Memory is reserved from the global heap in blocks of `block_size` bytes
+    // (or larger, for allocations that don't fit in a block)
+    explicit arena_t(size_t block_size = 64 * 1024);
+    ~arena_t() noexcept;
+    arena_t(arena_t const&) = delete;
+    arena_t(arena_t&&)      = delete;
+    arena_t& operator=(arena_t const&) = delete;
+    arena_t& operator=(arena_t&&) = delete;
+
+    // Returns `size` bytes aligned to 16 bytes, which are released along with
+    // the arena's frames. May be called from any thread.
+    void* allocate(size_t size)
+    {
+        size = (size + alignment - 1) & ~(alignment - 1);
+        block_t* block = current_.load(std::memory_order_acquire);
+        size_t offset  = block->offset.fetch_add(size, std::memory_order_relaxed);
+        if (offset + size <= block->capacity)
+        {
+            allocated_.fetch_add(size, std::memory_order_relaxed);
+            return block->data() + offset;
+        }
+        return allocate_slow(size);
+    }
+
+    // Allocates a coroutine frame, which must be freed with deallocate_frame
+    void* allocate_frame(size_t size)
+    {
+        // A new tree may start while the previous one is being released
+        if (frames_.fetch_add(1, std::memory_order_acquire) & releasing)
+        {
+            wait_for_release();
+        }
+        return allocate(size);
+    }
+
+    // Frees a coroutine frame, releasing every allocation if it was the last
+    // frame
+    void deallocate_frame() noexcept
+    {
+        if (frames_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            release();
+        }
+    }
+
+    // Releases every allocation, retaining the first block for reuse. No
+    // frames may be live, and the arena may not be allocated from
+    // concurrently.
+    void reset() noexcept;
+
+    // The number of bytes allocated since construction or the last reset
+    size_t size() const noexcept
+    {
+        return allocated_.load(std::memory_order_relaxed);
+    }
+
+    // The number of frames allocated from the arena that haven't been freed
+    size_t frames() const noexcept
+    {
+        return frames_.load(std::memory_order_acquire) & ~releasing;
+    }
+
+private:
+    constexpr static size_t alignment = 16;
+
+    struct alignas(alignment) block_t
+    {
+        block_t* next = nullptr;
+        size_t capacity;
+        std::atomic<size_t> offset{0};
+
+        char* data() noexcept
+        {
+            return reinterpret_cast<char*>(this + 1);
+        }
+    };
+
+    static block_t* create_block(size_t capacity);
+
+    void* allocate_slow(size_t size);
+
+    // Resets the arena unless a frame was allocated since the last one was
+    // freed
+    void release() noexcept;
+
+    void wait_for_release() const noexcept;
+
+    size_t block_size_;
+
+    // The block allocations are bumped from. Exhausted blocks remain linked
+    // behind it until the arena is reset.
+    std::atomic<block_t*> current_;
+    std::mutex mutex_;
+
+    std::atomic<size_t> allocated_{0};
+
+    // The number of live frames, flagged while the arena is being released
+    constexpr static uint64_t releasing = 1ull << 63;
+    std::atomic<uint64_t> frames_{0};
+};
+} // namespace coop
@@ -0,0 +1,258 @@
+#pragma once
+
+#include "cpu_mask.hpp"
+#include "detail/async_counter.hpp"
+#include "detail/concurrentqueue.h"
+#include "scheduler.hpp"
+#include "source_location.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#if defined(__clang__)
+#    include <experimental/coroutine>
+namespace std
+{
+using experimental::coroutine_handle;
+}
+#else
+#    include <coroutine>
+#endif
+
+namespace coop
+{
+// A bounded multi-producer multi-consumer queue of values passed between
+// coroutines. Sending to a full channel or receiving from an empty one
+// suspends the coroutine (rather than blocking its worker) until a receiver
+// or sender makes room or provides a value, after which it's rescheduled with
+// the supplied affinity and priority:
+//
+//     coop::channel_t<record_t> records{64};
+//
+//     co_await records.send(std::move(record));
+//     record_t record = co_await records.recv();
+//
+// While the channel is neither full nor empty, sending and receiving don't
+// take any locks. Values need only be move-constructible.
+template <typename T>
+class channel_t
+{
+public:
+    explicit channel_t(size_t capacity)
+        : queue_{capacity}
+        , slots_{int64_t(capacity)}
+        , items_{0}
+    {
+    }
+    channel_t(channel_t const&) = delete;
+    channel_t& operator=(channel_t const&) = delete;
+
+    template <Scheduler S>
+    class send_awaiter_t : detail::scheduled_waiter_t<S>
+    {
+    public:
+        send_awaiter_t(channel_t& channel,
+                       T value,
+                       S& scheduler,
+                       cpu_mask_t cpu_mask,
+                       uint32_t priority,
+                       source_location_t source_location) noexcept
+            : detail::scheduled_waiter_t<S>{scheduler,
+                                            std::move(cpu_mask),
+                                            priority,
+                                            source_location}
+            , channel_{channel}
+            , value_{std::move(value)}
+        {
+        }
+
+        send_awaiter_t(send_awaiter_t const&) = delete;
+        send_awaiter_t& operator=(send_awaiter_t const&) = delete;
+
+        bool await_ready() noexcept
+        {
+            return channel_.slots_.try_acquire();
+        }
+
+        bool await_suspend(std::coroutine_handle<> coroutine) noexcept
+        {
+            this->coroutine = coroutine;
+            return channel_.slots_.acquire_or_wait(*this);
+        }
+
+        // A slot has been reserved for the value by now
+        void await_resume()
+        {
+            channel_.push(std::move(value_));
+        }
+
+    private:
+        channel_t& channel_;
+        T value_;
+    };
+
+    template <Scheduler S>
+    class recv_awaiter_t : detail::scheduled_waiter_t<S>
+    {
+    public:
+        recv_awaiter_t(channel_t& channel,
+                       S& scheduler,
+                       cpu_mask_t cpu_mask,
+                       uint32_t priority,
+                       source_location_t source_location) noexcept
+            : detail::scheduled_waiter_t<S>{scheduler,
+                                            std::move(cpu_mask),
+                                            priority,
+                                            source_location}
+            , channel_{channel}
+        {
+        }
+
+        recv_awaiter_t(recv_awaiter_t const&) = delete;
+        recv_awaiter_t& operator=(recv_awaiter_t const&) = delete;
+
+        bool await_ready() noexcept
+        {
+            return channel_.items_.try_acquire();
+        }
+
+        bool await_suspend(std::coroutine_handle<> coroutine) noexcept
+        {
+            this->coroutine = coroutine;
+            return channel_.items_.acquire_or_wait(*this);
+        }
+
+        // An item has been reserved for us by now
+        T await_resume()
+        {
+            return channel_.pop();
+        }
+
+    private:
+        channel_t& channel_;
+    };
+
+    // Sends a value, suspending while the channel is full. Remember to
+    // `co_await` this function's returned value.
+    template <Scheduler S = scheduler_t>
+    send_awaiter_t<S> send(T value,
+                           S& scheduler                             = S::instance(),
+                           cpu_mask_t cpu_mask                      = {},
+                           uint32_t priority                        = 0,
+                           source_location_t const& source_location = {}) noexcept
+    {
+        return {*this,
+                std::move(value),
+                scheduler,
+                std::move(cpu_mask),
+                priority,
+                source_location};
+    }
+
+    // Receives a value, suspending while the channel is empty. Remember to
+    // `co_await` this function's returned value.
+    template <Scheduler S = scheduler_t>
+    recv_awaiter_t<S> recv(S& scheduler                             = S::instance(),
+                           cpu_mask_t cpu_mask                      = {},
+                           uint32_t priority                        = 0,
+                           source_location_t const& source_location = {}) noexcept
+    {
+        return {*this, scheduler, std::move(cpu_mask), priority, source_location};
+    }
+
+    // Sends a value if the channel isn't full without suspending, and may be
+    // called from any thread. The value is only moved from if it's sent.
+    bool try_send(T&& value)
+    {
+        if (!slots_.try_acquire())
+        {
+            return false;
+        }
+        push(std::move(value));
+        return true;
+    }
+
+    bool try_send(T const& value)
+    {
+        if (!slots_.try_acquire())
+        {
+            return false;
+        }
+        push(T{value});
+        return true;
+    }
+
+    // Receives a value if the channel isn't empty without suspending, and may
+    // be called from any thread
+    bool try_recv(T& value)
+    {
+        if (!items_.try_acquire())
+        {
+            return false;
+        }
+        value = pop();
+        return true;
+    }
+
+    // As above, for values that aren't default-constructible or assignable
+    std::optional<T> try_recv()
+    {
+        if (!items_.try_acquire())
+        {
+            return std::nullopt;
+        }
+        return pop();
+    }
+
+    // The approximate number of values in the channel
+    size_t size_approx() const noexcept
+    {
+        return queue_.size_approx();
+    }
+
+private:
+    void push(T&& value)
+    {
+        queue_.enqueue(std::move(value));
+        items_.release();
+    }
+
+    // Values are dequeued into uninitialized storage, so that they needn't be
+    // default-constructible or assignable
+    struct received_t
+    {
+        std::optional<T> value;
+
+        received_t&
+        operator=(T&& in) noexcept(std::is_nothrow_move_constructible_v<T>)
+        {
+            value.emplace(std::move(in));
+            return *this;
+        }
+    };
+
+    T pop()
+    {
+        // The reserved item has been enqueued, but a dequeue may still fail
+        // transiently while other consumers contend for the same producer's
+        // stream, so it's retried
+        received_t received;
+        while (!queue_.try_dequeue(received))
+        {
+            std::this_thread::yield();
+        }
+        slots_.release();
+        return std::move(*received.value);
+    }
+
+    moodycamel::ConcurrentQueue<T> queue_;
+
+    // Free slots, acquired by senders
+    detail::async_counter_t slots_;
+
+    // Enqueued values, acquired by receivers
+    detail::async_counter_t items_;
+};
+} // namespace coop
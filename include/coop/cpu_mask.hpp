@@ -0,0 +1,335 @@
+#pragma once
+
+#include "detail/api.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+
+namespace coop
+{
+// A set of CPUs used to express coroutine affinity. The least significant bit
+// of the first word corresponds to CPU 0.
+//
+// CPUs 0 through 63 are stored inline, so masks on machines with 64 or fewer
+// hardware threads never allocate and are as cheap to copy as a uint64_t.
+// Setting a CPU beyond that spills the remaining words to the heap, so any
+// number of CPUs can be represented.
+//
+// An empty mask is interpreted by the scheduler as "any CPU".
+class cpu_mask_t
+{
+public:
+    constexpr static uint32_t npos = ~0u;
+
+    // CPUs at or above this are rejected by parse, which is fed from the
+    // environment and sysfs. Linux itself supports at most 8192 CPUs.
+    constexpr static uint32_t max_cpus = 8192;
+
+    cpu_mask_t() noexcept = default;
+
+    // Implicit to remain source compatible with code that passes 64-bit masks
+    cpu_mask_t(uint64_t mask) noexcept
+        : low_{mask}
+    {
+    }
+
+    cpu_mask_t(cpu_mask_t const& other)
+        : low_{other.low_}
+    {
+        if (other.high_count_ != 0)
+        {
+            high_       = new uint64_t[other.high_count_];
+            high_count_ = other.high_count_;
+            std::memcpy(high_, other.high_, high_count_ * sizeof(uint64_t));
+        }
+    }
+
+    cpu_mask_t(cpu_mask_t&& other) noexcept
+        : low_{other.low_}
+        , high_count_{other.high_count_}
+        , high_{other.high_}
+    {
+        other.high_count_ = 0;
+        other.high_       = nullptr;
+    }
+
+    cpu_mask_t& operator=(cpu_mask_t const& other)
+    {
+        if (this != &other)
+        {
+            low_ = other.low_;
+            if (high_count_ < other.high_count_)
+            {
+                delete[] high_;
+                high_       = new uint64_t[other.high_count_];
+                high_count_ = other.high_count_;
+            }
+            for (uint32_t i = 0; i != high_count_; ++i)
+            {
+                high_[i] = i < other.high_count_ ? other.high_[i] : 0;
+            }
+        }
+        return *this;
+    }
+
+    cpu_mask_t& operator=(cpu_mask_t&& other) noexcept
+    {
+        if (this != &other)
+        {
+            delete[] high_;
+            low_              = other.low_;
+            high_count_       = other.high_count_;
+            high_             = other.high_;
+            other.high_count_ = 0;
+            other.high_       = nullptr;
+        }
+        return *this;
+    }
+
+    ~cpu_mask_t() noexcept
+    {
+        delete[] high_;
+    }
+
+    // Returns a mask with CPUs [0, count) set
+    static cpu_mask_t first(uint32_t count)
+    {
+        cpu_mask_t out;
+        if (count > 64)
+        {
+            out.reserve((count + 63) / 64);
+        }
+        for (uint32_t i = 0; i != out.word_count(); ++i, count -= 64)
+        {
+            out.word_ref(i) = count >= 64 ? ~0ull : (1ull << count) - 1;
+            if (count <= 64)
+            {
+                break;
+            }
+        }
+        return out;
+    }
+
+    // Parses a list of CPUs in the format used by Linux sysfs and cpusets
+    // (e.g. "0-3,8,10-11"). Parsing stops at the first character that isn't
+    // part of the list, such as a trailing newline. Malformed lists, such as
+    // reversed ranges or CPUs at or above max_cpus, yield an empty mask.
+    static cpu_mask_t parse(char const* list)
+    {
+        // Parses a CPU number, returning npos if it's missing or too large
+        auto number = [&list]() noexcept {
+            if (*list < '0' || *list > '9')
+            {
+                return npos;
+            }
+
+            uint32_t out = 0;
+            for (; *list >= '0' && *list <= '9'; ++list)
+            {
+                out = std::min(out * 10 + (*list - '0'), max_cpus);
+            }
+            return out < max_cpus ? out : npos;
+        };
+
+        cpu_mask_t out;
+        while (list && *list >= '0' && *list <= '9')
+        {
+            uint32_t first = number();
+            uint32_t last  = first;
+            if (*list == '-')
+            {
+                ++list;
+                last = number();
+            }
+
+            if (first == npos || last == npos || first > last)
+            {
+                return {};
+            }
+
+            for (uint32_t cpu = first; cpu <= last; ++cpu)
+            {
+                out.set(cpu);
+            }
+
+            if (*list != ',')
+            {
+                break;
+            }
+            ++list;
+        }
+        return out;
+    }
+
+    // The number of 64-bit words that may contain set bits
+    uint32_t word_count() const noexcept
+    {
+        return 1 + high_count_;
+    }
+
+    uint64_t word(uint32_t index) const noexcept
+    {
+        if (index == 0)
+        {
+            return low_;
+        }
+        return index - 1 < high_count_ ? high_[index - 1] : 0;
+    }
+
+    bool test(uint32_t cpu) const noexcept
+    {
+        return (word(cpu / 64) >> (cpu % 64)) & 1;
+    }
+
+    cpu_mask_t& set(uint32_t cpu)
+    {
+        reserve(cpu / 64 + 1);
+        word_ref(cpu / 64) |= 1ull << (cpu % 64);
+        return *this;
+    }
+
+    cpu_mask_t& reset(uint32_t cpu) noexcept
+    {
+        if (cpu / 64 < word_count())
+        {
+            word_ref(cpu / 64) &= ~(1ull << (cpu % 64));
+        }
+        return *this;
+    }
+
+    bool empty() const noexcept
+    {
+        for (uint32_t i = 0; i != word_count(); ++i)
+        {
+            if (word(i) != 0)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    uint32_t count() const noexcept
+    {
+        uint32_t out = 0;
+        for (uint32_t i = 0; i != word_count(); ++i)
+        {
+            out += std::popcount(word(i));
+        }
+        return out;
+    }
+
+    // Returns the lowest set CPU greater than or equal to `cpu`, or npos
+    uint32_t next(uint32_t cpu) const noexcept
+    {
+        for (uint32_t i = cpu / 64; i < word_count(); ++i)
+        {
+            uint64_t bits = word(i);
+            if (i == cpu / 64)
+            {
+                bits &= ~0ull << (cpu % 64);
+            }
+            if (bits != 0)
+            {
+                return i * 64 + std::countr_zero(bits);
+            }
+        }
+        return npos;
+    }
+
+    // Returns the nth (zero-indexed) set CPU, or npos
+    uint32_t nth(uint32_t n) const noexcept
+    {
+        for (uint32_t i = 0; i != word_count(); ++i)
+        {
+            uint64_t bits  = word(i);
+            uint32_t count = std::popcount(bits);
+            if (n < count)
+            {
+                // Iteratively unset the lowest bits to determine the nth set
+                // bit
+                for (; n != 0; --n)
+                {
+                    bits &= bits - 1;
+                }
+                return i * 64 + std::countr_zero(bits);
+            }
+            n -= count;
+        }
+        return npos;
+    }
+
+    cpu_mask_t& operator&=(cpu_mask_t const& other) noexcept
+    {
+        for (uint32_t i = 0; i != word_count(); ++i)
+        {
+            word_ref(i) &= other.word(i);
+        }
+        return *this;
+    }
+
+    cpu_mask_t& operator|=(cpu_mask_t const& other)
+    {
+        reserve(other.word_count());
+        for (uint32_t i = 0; i != other.word_count(); ++i)
+        {
+            word_ref(i) |= other.word(i);
+        }
+        return *this;
+    }
+
+    friend cpu_mask_t operator&(cpu_mask_t lhs, cpu_mask_t const& rhs) noexcept
+    {
+        return lhs &= rhs;
+    }
+
+    friend cpu_mask_t operator|(cpu_mask_t lhs, cpu_mask_t const& rhs)
+    {
+        return lhs |= rhs;
+    }
+
+    friend bool operator==(cpu_mask_t const& lhs, cpu_mask_t const& rhs) noexcept
+    {
+        uint32_t count = std::max(lhs.word_count(), rhs.word_count());
+        for (uint32_t i = 0; i != count; ++i)
+        {
+            if (lhs.word(i) != rhs.word(i))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    uint64_t& word_ref(uint32_t index) noexcept
+    {
+        return index == 0 ? low_ : high_[index - 1];
+    }
+
+    // Ensures storage for at least `words` words
+    void reserve(uint32_t words)
+    {
+        if (words <= word_count())
+        {
+            return;
+        }
+
+        uint64_t* high = new uint64_t[words - 1]{};
+        if (high_count_ != 0)
+        {
+            std::memcpy(high, high_, high_count_ * sizeof(uint64_t));
+        }
+        delete[] high_;
+        high_       = high;
+        high_count_ = words - 1;
+    }
+
+    // CPUs [0, 64)
+    uint64_t low_        = 0;
+    uint32_t high_count_ = 0;
+    // CPUs [64, 64 * (1 + high_count_))
+    uint64_t* high_ = nullptr;
+};
+} // namespace coop
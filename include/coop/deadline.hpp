@@ -0,0 +1,10 @@
+#pragma once
+
+#include <chrono>
+
+namespace coop
+{
+// A point in time by which a coroutine should be run. Coroutines scheduled
+// with a deadline are run in earliest-deadline-first order.
+using deadline_t = std::chrono::steady_clock::time_point;
+} // namespace coop
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "api.hpp"
+#include <atomic>
+#include <coop/cpu_mask.hpp>
+#include <coop/source_location.hpp>
+#include <cstdint>
+#include <mutex>
+#if defined(__clang__)
+#    include <experimental/coroutine>
+namespace std
+{
+using experimental::coroutine_handle;
+}
+#else
+#    include <coroutine>
+#endif
+
+namespace coop
+{
+namespace detail
+{
+    // A suspended coroutine waiting on an async_counter_t. Waiters live in the
+    // awaiters of the coroutines they represent, so waiting never allocates.
+    struct waiter_t
+    {
+        waiter_t* next = nullptr;
+        std::coroutine_handle<> coroutine;
+
+        // Invoked (outside of any lock) to resume the coroutine
+        void (*wake)(waiter_t&) noexcept = nullptr;
+    };
+
+    // A waiter resumed by scheduling it with the affinity and priority it
+    // awaited with. The base may be a waiter type extending waiter_t.
+    template <typename S, typename Base = waiter_t>
+    struct scheduled_waiter_t : Base
+    {
+        S& scheduler;
+        cpu_mask_t cpu_mask;
+        uint32_t priority;
+        source_location_t source_location;
+
+        scheduled_waiter_t(S& scheduler,
+                           cpu_mask_t cpu_mask,
+                           uint32_t priority,
+                           source_location_t source_location) noexcept
+            : scheduler{scheduler}
+            , cpu_mask{std::move(cpu_mask)}
+            , priority{priority}
+            , source_location{source_location}
+        {
+            this->wake = [](waiter_t& waiter) noexcept {
+                auto& self = static_cast<scheduled_waiter_t&>(waiter);
+                self.scheduler.schedule(self.coroutine,
+                                        self.cpu_mask,
+                                        self.priority,
+                                        self.source_location);
+            };
+        }
+    };
+
+    // A counter of units (e.g. free slots or queued items) that coroutines
+    // wait on. Acquiring while units are available is a single
+    // compare-and-swap. Otherwise, the waiter is queued in FIFO order under a
+    // lock and handed a unit directly by a later release.
+    class COOP_API async_counter_t
+    {
+    public:
+        explicit async_counter_t(int64_t count) noexcept
+            : count_{count}
+        {
+        }
+        async_counter_t(async_counter_t const&) = delete;
+        async_counter_t& operator=(async_counter_t const&) = delete;
+
+        bool try_acquire() noexcept
+        {
+            int64_t count = count_.load();
+            while (count > 0)
+            {
+                if (count_.compare_exchange_weak(count, count - 1))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Acquires a unit if one is available, returning false. Otherwise,
+        // queues the waiter to be woken once it's handed a unit and returns
+        // true.
+        bool acquire_or_wait(waiter_t& waiter) noexcept;
+
+        void release(int64_t count = 1) noexcept
+        {
+            count_.fetch_add(count);
+            // Pairs with the increment in acquire_or_wait so that either the
+            // waiter sees our unit or we see the waiter
+            if (waiting_.load() != 0)
+            {
+                wake();
+            }
+        }
+
+        // The number of units available, which is approximate if the counter
+        // is in use by other threads
+        int64_t count() const noexcept
+        {
+            return count_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        // Hands units to queued waiters while both are available
+        void wake() noexcept;
+
+        std::atomic<int64_t> count_;
+
+        // The number of coroutines in the slow path of acquire_or_wait or
+        // queued
+        std::atomic<uint32_t> waiting_{0};
+
+        std::mutex mutex_;
+        waiter_t* head_ = nullptr;
+        waiter_t* tail_ = nullptr;
+    };
+} // namespace detail
+} // namespace coop
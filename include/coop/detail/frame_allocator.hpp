@@ -0,0 +1,22 @@
+#pragma once
+
+#include "api.hpp"
+#include <cstddef>
+
+namespace coop
+{
+namespace detail
+{
+    // Coroutine frames are allocated from per-thread caches of size-segregated
+    // free lists, so spawning a coroutine usually costs a pointer pop rather
+    // than a trip through malloc. Frames larger than the largest size class
+    // are allocated with the global operator new.
+    //
+    // A frame may be freed on any thread. Frames freed on the thread that
+    // allocated them are pushed to its free lists directly, while frames freed
+    // elsewhere are pushed to a lock-free list owned by the allocating thread,
+    // which reclaims them once its own free list runs dry.
+    COOP_API void* allocate_frame(size_t size);
+    COOP_API void deallocate_frame(void* frame, size_t size) noexcept;
+} // namespace detail
+} // namespace coop
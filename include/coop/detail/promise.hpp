@@ -1,15 +1,21 @@
 #pragma once
 
+#include "../arena.hpp"
+#include "frame_allocator.hpp"
 #include "tracer.hpp"
 #include <atomic>
-#include <semaphore>
+#include <cstdint>
+#include <memory>
+#include <new>
 #include <thread>
+#include <utility>
 #if defined(__clang__)
 #    include <experimental/coroutine>
 namespace std
 {
 using experimental::coroutine_handle;
 using experimental::noop_coroutine;
+using experimental::suspend_always;
 using experimental::suspend_never;
 } // namespace std
 #else
@@ -20,6 +26,86 @@ namespace coop
 {
 namespace detail
 {
+    // Coroutine frames are prefixed with the arena they were allocated from,
+    // so that frames allocated from an arena aren't freed individually
+    struct alignas(16) frame_header_t
+    {
+        arena_t* arena;
+    };
+
+    inline void* allocate_promise_frame(size_t size, arena_t* arena)
+    {
+        size += sizeof(frame_header_t);
+        void* raw;
+        if (arena)
+        {
+            raw = arena->allocate_frame(size);
+        }
+        else
+        {
+#if defined(COOP_DISABLE_FRAME_POOL)
+            raw = ::operator new(size);
+#else
+            raw = allocate_frame(size);
+#endif
+        }
+        return new (raw) frame_header_t{arena} + 1;
+    }
+
+    inline void deallocate_promise_frame(void* frame, size_t size) noexcept
+    {
+        frame_header_t* header = static_cast<frame_header_t*>(frame) - 1;
+        if (header->arena)
+        {
+            // Released along with the rest of the arena's frames
+            header->arena->deallocate_frame();
+            return;
+        }
+
+        size += sizeof(frame_header_t);
+#if defined(COOP_DISABLE_FRAME_POOL)
+        ::operator delete(header, size);
+#else
+        deallocate_frame(header, size);
+#endif
+    }
+
+    // Shared by the tasks awaited together by when_all or when_any (see
+    // when.hpp). Each task registered with the state releases one count when
+    // it completes, and whoever releases the last count resumes the parent.
+    struct when_state_t
+    {
+        std::coroutine_handle<> parent;
+        std::atomic<size_t> count;
+
+        // Used by when_any only. The promise of the first task to complete,
+        // and a function withdrawing the state from the remaining tasks (each
+        // successful withdrawal releases the task's count on its behalf).
+        std::atomic<void*> first = nullptr;
+        void (*withdraw)(when_state_t&) noexcept = nullptr;
+
+        std::coroutine_handle<> complete(void* promise) noexcept
+        {
+            if (withdraw)
+            {
+                void* expected = nullptr;
+                if (first.compare_exchange_strong(
+                        expected, promise, std::memory_order_acq_rel))
+                {
+                    withdraw(*this);
+                }
+            }
+
+            // The state may be destroyed as soon as our count is released
+            std::coroutine_handle<> next = parent;
+            if (count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                return next;
+            }
+            return std::noop_coroutine();
+        }
+    };
+
     template <typename P, bool Joinable>
     struct final_awaiter_t
     {
@@ -42,29 +128,27 @@ namespace detail
             COOP_LOG("Final await for coroutine %p on thread %zu\n",
                      coroutine.address(),
                      detail::thread_id());
-            // After acquiring the flag, the other thread's write to the
+            P& promise = coroutine.promise();
+
+            // After acquiring the waiter, the other thread's write to the
             // coroutine's continuation must be visible (one-way
             // communication)
-            if (coroutine.promise().flag.exchange(true, std::memory_order_acquire))
+            uintptr_t waiter
+                = promise.waiter.exchange(P::waiter_done, std::memory_order_acq_rel);
+            if (waiter == P::waiter_awaited)
             {
                 // We're not the first to reach here, meaning the
-                // continuation is installed properly (if any)
-                auto continuation = coroutine.promise().continuation;
-                if (continuation)
-                {
-                    COOP_LOG("Resuming continuation %p on %p on thread %zu\n",
-                             continuation.address(),
-                             coroutine.address(),
-                             detail::thread_id());
-                    return continuation;
-                }
-                else
-                {
-                    COOP_LOG(
-                        "Coroutine %p on thread %zu missing continuation\n",
-                        coroutine.address(),
-                        detail::thread_id());
-                }
+                // continuation is installed properly
+                COOP_LOG("Resuming continuation %p on %p on thread %zu\n",
+                         promise.continuation.address(),
+                         coroutine.address(),
+                         detail::thread_id());
+                return promise.continuation;
+            }
+            else if (waiter != P::waiter_idle)
+            {
+                // Awaited with other tasks by when_all or when_any
+                return reinterpret_cast<when_state_t*>(waiter)->complete(&promise);
             }
             return std::noop_coroutine();
         }
@@ -84,8 +168,25 @@ namespace detail
 
         void await_suspend(std::coroutine_handle<P> coroutine) const noexcept
         {
-            coroutine.promise().join_sem.release();
-            coroutine.destroy();
+            P& promise = coroutine.promise();
+
+            // Completion is published in the same step as our reference is
+            // dropped, so once a joiner observes it, the task_t holds the
+            // last reference and the frame is destroyed on the joiner's side.
+            // The frame isn't accessed after this, except that parked joiners
+            // are woken through the join word's address (like a futex-based
+            // mutex, waking on memory the joiner may have freed is harmless).
+            uint32_t state = promise.join_state.fetch_sub(
+                P::join_reference - P::join_completed, std::memory_order_acq_rel);
+            if (state < 2 * P::join_reference)
+            {
+                // The task was detached, so this was the last reference
+                coroutine.destroy();
+            }
+            else if (state & P::join_waiting)
+            {
+                promise.join_state.notify_all();
+            }
         }
     };
 
@@ -109,10 +210,15 @@ namespace detail
                      detail::thread_id());
             base.promise().continuation = next;
             // The write to the continuation must be visible to a person that
-            // acquires the flag
-            if (base.promise().flag.exchange(true, std::memory_order_release))
+            // acquires the waiter
+            uintptr_t waiter = P::waiter_idle;
+            if (!base.promise().waiter.compare_exchange_strong(
+                    waiter,
+                    P::waiter_awaited,
+                    std::memory_order_release,
+                    std::memory_order_relaxed))
             {
-                // We're not the first to reach here, meaning the continuation
+                // The coroutine already completed, meaning the continuation
                 // won't get read
                 return next;
             }
@@ -120,12 +226,54 @@ namespace detail
         }
     }
 
+    // Common to eager and lazy promises: frames are allocated from pools, or
+    // from an arena passed to the coroutine explicitly
+    struct promise_frame_t
+    {
+        void unhandled_exception() const noexcept
+        {
+            // Coop doesn't currently handle exceptions.
+        }
+
+        // Frames are allocated from per-thread pools, unless the coroutine
+        // takes `std::allocator_arg` and an arena as its leading parameters
+        // (following the object parameter, if any). Arenas aren't inherited,
+        // so coroutines called or spawned by such a coroutine only allocate
+        // from its arena if they're passed it too.
+        static void* operator new(size_t size)
+        {
+            return allocate_promise_frame(size, nullptr);
+        }
+
+        template <typename... Args>
+        static void*
+        operator new(size_t size, std::allocator_arg_t, arena_t& arena, Args const&...)
+        {
+            return allocate_promise_frame(size, &arena);
+        }
+
+        template <typename Object, typename... Args>
+        static void* operator new(size_t size,
+                                  Object const&,
+                                  std::allocator_arg_t,
+                                  arena_t& arena,
+                                  Args const&...)
+        {
+            return allocate_promise_frame(size, &arena);
+        }
+
+        static void operator delete(void* frame, size_t size) noexcept
+        {
+            deallocate_promise_frame(frame, size);
+        }
+    };
+
     // All promises need the `continuation` member, which is set when a
     // coroutine is suspended within another coroutine. The `continuation`
     // handle is used to hop back from that suspension point when the inner
     // coroutine finishes.
     template <bool Joinable>
-    struct promise_base_t
+    struct promise_base_t : public promise_frame_t
     {
         constexpr static bool joinable_v = Joinable;
 
@@ -133,25 +281,45 @@ namespace detail
         // resume point, which immediately following the suspend point.
         std::coroutine_handle<> continuation = nullptr;
 
-        std::atomic<bool> flag = false;
+        // Whether the coroutine has completed or has a waiter. A waiter is
+        // either the continuation above or a when_state_t, whose address is
+        // stored in place of the constants below.
+        constexpr static uintptr_t waiter_idle    = 0;
+        constexpr static uintptr_t waiter_awaited = 1;
+        constexpr static uintptr_t waiter_done    = 2;
+
+        std::atomic<uintptr_t> waiter = waiter_idle;
 
         // Do not suspend immediately on entry of a coroutine
         std::suspend_never initial_suspend() const noexcept
         {
             return {};
         }
-
-        void unhandled_exception() const noexcept
-        {
-            // Coop doesn't currently handle exceptions.
-        }
     };
 
-    // Joinable tasks need an additional semaphore the joiner can wait on
+    // Joinable tasks need an additional word the joiner can wait on. The
+    // frame is shared by the coroutine and its task_t, and is destroyed by
+    // whichever of the two releases it last, so a task may be joined (or its
+    // result read) after the coroutine has completed.
     template <>
     struct promise_base_t<true> : public promise_base_t<false>
     {
-        std::binary_semaphore join_sem{0};
+        constexpr static uint32_t join_completed = 1;
+        constexpr static uint32_t join_waiting   = 2;
+        constexpr static uint32_t join_reference = 4;
+
+        // The low bits flag completion and whether a joiner may be parked,
+        // and the remaining bits count references to the frame
+        std::atomic<uint32_t> join_state = 2 * join_reference;
+
+        void release(std::coroutine_handle<> coroutine) noexcept
+        {
+            if (join_state.fetch_sub(join_reference, std::memory_order_acq_rel)
+                < 2 * join_reference)
+            {
+                coroutine.destroy();
+            }
+        }
     };
 
     template <typename Task, typename T, bool Joinable>
@@ -203,5 +371,82 @@ namespace detail
             return {};
         }
     };
+    // Lazy coroutines only start once awaited, on the awaiting thread, so the
+    // awaiting coroutine is always suspended before the lazy one runs and no
+    // synchronization is needed to install the continuation
+    template <typename P>
+    struct lazy_final_awaiter_t
+    {
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        void await_resume() const noexcept
+        {
+        }
+
+        std::coroutine_handle<>
+        await_suspend(std::coroutine_handle<P> coroutine) const noexcept
+        {
+            return coroutine.promise().continuation;
+        }
+    };
+
+    struct lazy_promise_base_t : public promise_frame_t
+    {
+        std::coroutine_handle<> continuation = nullptr;
+
+        std::suspend_always initial_suspend() const noexcept
+        {
+            return {};
+        }
+    };
+
+    template <typename Task, typename T>
+    struct lazy_promise_t : public lazy_promise_base_t
+    {
+        T data;
+
+        Task get_return_object() noexcept
+        {
+            return {std::coroutine_handle<lazy_promise_t>::from_promise(*this)};
+        }
+
+        void
+        return_value(T const& value) noexcept(std::is_nothrow_copy_assignable_v<T>)
+        {
+            data = value;
+        }
+
+        void
+        return_value(T&& value) noexcept(std::is_nothrow_move_assignable_v<T>)
+        {
+            data = std::move(value);
+        }
+
+        lazy_final_awaiter_t<lazy_promise_t> final_suspend() noexcept
+        {
+            return {};
+        }
+    };
+
+    template <typename Task>
+    struct lazy_promise_t<Task, void> : public lazy_promise_base_t
+    {
+        Task get_return_object() noexcept
+        {
+            return {std::coroutine_handle<lazy_promise_t>::from_promise(*this)};
+        }
+
+        void return_void() noexcept
+        {
+        }
+
+        lazy_final_awaiter_t<lazy_promise_t> final_suspend() noexcept
+        {
+            return {};
+        }
+    };
 } // namespace detail
 } // namespace coop
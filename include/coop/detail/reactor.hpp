@@ -0,0 +1,107 @@
+#pragma once
+
+#if defined(__linux__)
+
+#    include "api.hpp"
+#    include "async_counter.hpp"
+#    include <atomic>
+#    include <cstdint>
+#    include <thread>
+
+namespace coop
+{
+namespace detail
+{
+    // Waits for a file descriptor registered with reactor_t::wait. Waiters
+    // live in the awaiters of the coroutines they represent, so waiting never
+    // allocates.
+    struct reactor_waiter_t : waiter_t
+    {
+        // Invoked on the reactor thread (under the lock of the descriptor's
+        // registration) when the descriptor is reported ready, returning
+        // whether the waiter should be woken or keep waiting. This lets only
+        // one waiter consume an auto-reset event's signal, for example. Null
+        // always wakes the waiter.
+        bool (*claim)(reactor_waiter_t& waiter) noexcept = nullptr;
+    };
+
+    // Waits on file descriptors with edge-triggered epoll registrations on a
+    // dedicated thread. Waiting and forgetting are O(1) and may be done from any
+    // thread, and each wakeup only visits descriptors that are
+    // ready, so any number of waits may be pending.
+    class COOP_API reactor_t
+    {
+    public:
+        reactor_t();
+        ~reactor_t() noexcept;
+        reactor_t(reactor_t const&) = delete;
+        reactor_t(reactor_t&&)      = delete;
+        reactor_t& operator=(reactor_t const&) = delete;
+        reactor_t& operator=(reactor_t&&) = delete;
+
+        // Queues the waiter until the descriptor is reported readable (for
+        // EPOLLIN) or writable (for EPOLLOUT), at which point its wake function
+        // is invoked on the reactor thread. Each descriptor is registered with
+        // the reactor once, the first time it's awaited, and stays registered
+        // until it's closed or reactor_t::forget is called for it. Waiting
+        // doesn't allocate or duplicate the descriptor, so the number of
+        // pending waits isn't limited by the number of descriptors the process
+        // may open.
+        //
+        // As the registration is edge-triggered, readiness predating the
+        // waiter must be detected when it's queued. If the waiter has a claim
+        // function, it's tried once the waiter is queued, and the waiter is
+        // woken before this returns if it succeeds. Otherwise, the
+        // registration is rearmed (a single epoll_ctl), which reports the
+        // descriptor again if it's already ready. Rearming also replaces the
+        // registration of a descriptor that was closed and whose number was
+        // reused, so descriptors awaited without a claim function (e.g.
+        // sockets) needn't be forgotten before they're closed.
+        //
+        // Returns false (with errno set) if the descriptor can't be
+        // registered, in which case the waiter isn't queued.
+        bool wait(int fd, uint32_t events, reactor_waiter_t& waiter) noexcept;
+
+        // Deregisters a descriptor awaited with a claim function from every
+        // reactor. This must be called before closing such a descriptor (as
+        // its number may otherwise be reused by a descriptor the reactor
+        // wrongly considers registered), and no waiters may be pending on it.
+        static void forget(int fd) noexcept;
+
+        // Stops and joins the reactor thread. Pending waiters are not woken.
+        void stop() noexcept;
+
+    private:
+        struct registration_t;
+
+        // Registrations are allocated in chunks on demand, indexed by
+        // descriptor, and are only freed with the reactor. The reactor thread
+        // may thus dispatch a registration at any time without it being freed
+        // underneath it.
+        constexpr static uint32_t chunk_bits  = 10;
+        constexpr static uint32_t chunk_size  = 1 << chunk_bits;
+        constexpr static uint32_t chunk_count = 1024;
+
+        // Returns the registration for the descriptor, allocating its chunk
+        // if `create` is set. Returns null if the descriptor is out of range
+        // (with errno set to EMFILE) or hasn't been allocated.
+        registration_t* registration(int fd, bool create) noexcept;
+
+        static void dispatch(registration_t& registration, uint32_t events) noexcept;
+
+        std::thread thread_;
+        std::atomic<bool> active_;
+        int epoll_fd_ = -1;
+
+        // Registered with null user data to wake the thread when stopping
+        int wake_fd_ = -1;
+
+        std::atomic<registration_t*> chunks_[chunk_count] = {};
+
+        // Reactors are tracked so that forget can reach all of them
+        reactor_t* next_ = nullptr;
+    };
+} // namespace detail
+} // namespace coop
+
+#endif
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#if defined(__clang__)
+#    include <experimental/coroutine>
+namespace std
+{
+using experimental::coroutine_handle;
+}
+#else
+#    include <coroutine>
+#endif
+
+namespace coop
+{
+namespace detail
+{
+    // Bounded Chase-Lev work stealing deque of coroutine handles (see "Correct
+    // and Efficient Work-Stealing for Weak Memory Models", Lê et al. 2013).
+    //
+    // Only the owning worker thread may push and pop, both of which operate on
+    // the bottom of the deque. Pushing costs a couple of plain loads and
+    // stores, and popping only requires a CAS when racing a thief for the last
+    // remaining coroutine. Any other thread may steal from the top.
+    class work_deque_t
+    {
+    public:
+        // The capacity is rounded up to the next power of two
+        explicit work_deque_t(size_t capacity = 256)
+        {
+            capacity = std::bit_ceil(capacity < 2 ? 2 : capacity);
+            mask_    = static_cast<int64_t>(capacity - 1);
+            slots_   = new std::atomic<void*>[capacity];
+        }
+
+        ~work_deque_t() noexcept
+        {
+            delete[] slots_;
+        }
+
+        work_deque_t(work_deque_t const&) = delete;
+        work_deque_t(work_deque_t&&)      = delete;
+        work_deque_t& operator=(work_deque_t const&) = delete;
+        work_deque_t& operator=(work_deque_t&&) = delete;
+
+        // Returns false if the deque is full. Owner only.
+        bool push(std::coroutine_handle<> coroutine) noexcept
+        {
+            int64_t bottom = bottom_.load(std::memory_order_relaxed);
+            int64_t top    = top_.load(std::memory_order_acquire);
+            if (bottom - top > mask_)
+            {
+                return false;
+            }
+
+            slots_[bottom & mask_].store(
+                coroutine.address(), std::memory_order_relaxed);
+            // Publish the slot to thieves that acquire the bottom index
+            bottom_.store(bottom + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Pops the most recently pushed coroutine. Owner only.
+        bool pop(std::coroutine_handle<>& coroutine) noexcept
+        {
+            int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+            bottom_.store(bottom, std::memory_order_relaxed);
+            // The reservation of the bottom slot must be ordered before the
+            // load of the top index (store-load ordering requires a full
+            // fence)
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t top = top_.load(std::memory_order_relaxed);
+
+            if (top > bottom)
+            {
+                // Empty
+                bottom_.store(bottom + 1, std::memory_order_relaxed);
+                return false;
+            }
+
+            void* address
+                = slots_[bottom & mask_].load(std::memory_order_relaxed);
+            if (top == bottom)
+            {
+                // This is the last coroutine, so race any thieves for it
+                bool won = top_.compare_exchange_strong(
+                    top,
+                    top + 1,
+                    std::memory_order_seq_cst,
+                    std::memory_order_relaxed);
+                bottom_.store(bottom + 1, std::memory_order_relaxed);
+                if (!won)
+                {
+                    return false;
+                }
+            }
+
+            coroutine = std::coroutine_handle<>::from_address(address);
+            return true;
+        }
+
+        // Steals the least recently pushed coroutine. Safe to call from any
+        // thread, but may fail spuriously when racing other thieves.
+        bool steal(std::coroutine_handle<>& coroutine) noexcept
+        {
+            int64_t top = top_.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t bottom = bottom_.load(std::memory_order_acquire);
+
+            if (top >= bottom)
+            {
+                return false;
+            }
+
+            // This read may be stale if the owner has since wrapped around
+            // and overwritten the slot, but in that case the top index has
+            // moved on and the CAS below fails
+            void* address = slots_[top & mask_].load(std::memory_order_relaxed);
+            if (!top_.compare_exchange_strong(top,
+                                              top + 1,
+                                              std::memory_order_seq_cst,
+                                              std::memory_order_relaxed))
+            {
+                return false;
+            }
+
+            coroutine = std::coroutine_handle<>::from_address(address);
+            return true;
+        }
+
+        size_t size_approx() const noexcept
+        {
+            int64_t bottom = bottom_.load(std::memory_order_relaxed);
+            int64_t top    = top_.load(std::memory_order_relaxed);
+            return bottom > top ? static_cast<size_t>(bottom - top) : 0;
+        }
+
+    private:
+        // The indices are written by different threads (thieves and the owner
+        // respectively) so keep them on separate cache lines
+        alignas(64) std::atomic<int64_t> top_{0};
+        alignas(64) std::atomic<int64_t> bottom_{0};
+        std::atomic<void*>* slots_ = nullptr;
+        int64_t mask_              = 0;
+    };
+} // namespace detail
+} // namespace coop
@@ -2,7 +2,10 @@
 
 #include "api.hpp"
 #include "concurrentqueue.h"
+#include "work_deque.hpp"
 #include <atomic>
+#include <coop/cpu_mask.hpp>
+#include <coop/deadline.hpp>
 #include <coop/source_location.hpp>
 #include <semaphore>
 #if defined(__clang__)
@@ -15,10 +18,7 @@ using experimental::coroutine_handle;
 #    include <coroutine>
 #endif
 #include <thread>
-
-// Currently, COOP supports exactly two priority levels, 0 (default) and 1
-// (high)
-#define COOP_PRIORITY_COUNT 2
+#include <vector>
 
 namespace coop
 {
@@ -26,40 +26,162 @@ class scheduler_t;
 
 namespace detail
 {
+    // Coroutines constrained by affinity are kept apart from those that may
+    // run anywhere, so items carry no affinity of their own
+    struct work_item_t
+    {
+        std::coroutine_handle<> coroutine;
+    };
+
+    struct deadline_item_t
+    {
+        std::coroutine_handle<> coroutine;
+        deadline_t deadline;
+    };
+
     class COOP_API work_queue_t
     {
     public:
-        work_queue_t(scheduler_t& scheduler, uint32_t id);
+        // The worker thread is bound to the CPUs in `pin_mask` (if any).
+        // `capacity` is the initial capacity of the queue for each of the
+        // scheduler's priority levels.
+        work_queue_t(scheduler_t& scheduler,
+                     uint32_t id,
+                     uint32_t cpu,
+                     cpu_mask_t pin_mask,
+                     size_t capacity);
         ~work_queue_t() noexcept;
         work_queue_t(work_queue_t const&) = delete;
         work_queue_t(work_queue_t&&)      = delete;
         work_queue_t& operator=(work_queue_t const&) = delete;
         work_queue_t& operator=(work_queue_t&&) = delete;
 
+        // Returns the work queue owned by the calling thread, or nullptr if
+        // the calling thread isn't a worker thread
+        static work_queue_t* current() noexcept;
+
         // Returns the approximate size across all queues of any priority
         size_t size_approx() const noexcept
         {
             size_t out = 0;
-            for (size_t i = 0; i != COOP_PRIORITY_COUNT; ++i)
+            for (size_t i = 0; i != priority_count_; ++i)
             {
-                out += queues_[i].size_approx();
+                out += queues_[i].size_approx() + pinned_queues_[i].size_approx()
+                       + deques_[i].size_approx();
             }
-            return out;
+            return out + deadline_queue_.size_approx()
+                   + pinned_deadline_queue_.size_approx();
+        }
+
+        uint32_t id() const noexcept
+        {
+            return id_;
+        }
+
+        // The CPU this worker is assigned to
+        uint32_t cpu() const noexcept
+        {
+            return cpu_;
+        }
+
+        scheduler_t& scheduler() const noexcept
+        {
+            return scheduler_;
         }
 
         void enqueue(std::coroutine_handle<> coroutine,
+                     cpu_mask_t cpu_affinity           = {},
                      uint32_t priority                 = 0,
                      source_location_t source_location = {});
 
+        // Coroutines enqueued with a deadline are run ahead of coroutines
+        // enqueued by priority, in earliest-deadline-first order
+        void enqueue(std::coroutine_handle<> coroutine,
+                     deadline_t deadline,
+                     cpu_mask_t cpu_affinity           = {},
+                     source_location_t source_location = {});
+
+        // Pushes a coroutine that may run on any CPU to this worker's own
+        // deque, to be popped in LIFO order by this worker or stolen by an
+        // idle peer. May only be called from this queue's worker thread and
+        // returns false if the deque is full.
+        bool push_local(std::coroutine_handle<> coroutine,
+                        uint32_t priority                 = 0,
+                        source_location_t source_location = {}) noexcept;
+
+        // Wakes the worker so that it attempts to steal from its peers
+        void notify() noexcept
+        {
+            sem_.release();
+        }
+
+        // Attempts to remove a coroutine from this queue on behalf of an idle
+        // worker assigned to CPU `thief`. Only coroutines unconstrained by
+        // affinity are handed out, with coroutines that have deadlines
+        // preferred, followed by higher priority coroutines.
+        bool try_steal(uint32_t thief, std::coroutine_handle<>& coroutine);
+
+        // Signals the worker thread to exit and joins it. The scheduler stops
+        // all workers before destroying any of them, as a worker may be in the
+        // middle of stealing from one of its peers.
+        void stop() noexcept;
+
     private:
+        // Dequeues from the highest priority level with work that has credit
+        // remaining in the current round, starting a new round once every
+        // level with work has exhausted its credit
+        bool try_dequeue(std::coroutine_handle<>& coroutine);
+
+        bool try_dequeue(uint32_t priority, std::coroutine_handle<>& coroutine);
+
+        // Moves coroutines from the deadline queue to the deadline heap and
+        // pops the one with the earliest deadline
+        bool try_dequeue_deadline(std::coroutine_handle<>& coroutine);
+
+        // Visits peer queues in turn, starting with the adjacent one
+        bool try_steal_from_peers(std::coroutine_handle<>& coroutine);
+
         scheduler_t& scheduler_;
         uint32_t id_;
+        uint32_t cpu_;
         std::thread thread_;
         std::atomic<bool> active_;
         std::counting_semaphore<> sem_;
 
-        moodycamel::ConcurrentQueue<std::coroutine_handle<>>
-            queues_[COOP_PRIORITY_COUNT];
+        // Coroutines enqueued by other threads. Allocated as an array with one
+        // queue per priority. Only coroutines that may run on any CPU are
+        // enqueued here, so any peer may steal them.
+        moodycamel::ConcurrentQueue<work_item_t>* queues_ = nullptr;
+
+        // As above, for coroutines constrained by affinity. Only this worker
+        // dequeues them, so a peer never has to inspect and hand back a
+        // coroutine it isn't permitted to run.
+        moodycamel::ConcurrentQueue<work_item_t>* pinned_queues_ = nullptr;
+
+        // Coroutines scheduled by this worker onto itself. These are always
+        // unconstrained by affinity, so any peer may steal them. Allocated as
+        // an array with one deque per priority.
+        work_deque_t* deques_ = nullptr;
+
+        // Coroutines with deadlines enqueued by any thread (including this
+        // worker). Unconstrained ones remain stealable until this worker moves
+        // them to its deadline heap, which it only does when it's ready to run
+        // one. Those constrained by affinity are kept apart as above.
+        moodycamel::ConcurrentQueue<deadline_item_t> deadline_queue_;
+        moodycamel::ConcurrentQueue<deadline_item_t> pinned_deadline_queue_;
+
+        // A min-heap ordered by deadline. Only accessed by the worker thread.
+        std::vector<deadline_item_t> deadline_heap_;
+
+        uint32_t priority_count_;
+
+        // The number of coroutines each priority level may still run in the
+        // current round. Only accessed by the worker thread.
+        uint32_t* credits_ = nullptr;
+
+        // Alternates which of a level's queues is dequeued from first, so
+        // that neither starves the other. Only accessed by the worker thread.
+        bool pinned_first_ = false;
 
         char label_[64];
     };
@@ -1,6 +1,11 @@
 #pragma once
 
+#include "cpu_mask.hpp"
 #include "detail/api.hpp"
+#include "detail/async_counter.hpp"
+#if defined(__linux__)
+#    include "detail/reactor.hpp"
+#endif
 #if defined(__clang__)
 #    include <experimental/coroutine>
 namespace std
@@ -11,11 +16,22 @@ using experimental::coroutine_handle;
 #    include <coroutine>
 #endif
 #include <cstdint>
+#include <utility>
 
 namespace coop
 {
 class scheduler_t;
 
+namespace detail
+{
+    // A coroutine waiting for an event, queued with scheduler_t::schedule
+#if defined(__linux__)
+    using event_waiter_t = reactor_waiter_t;
+#else
+    using event_waiter_t = waiter_t;
+#endif
+} // namespace detail
+
 // Non-owning reference to an event
 class COOP_API event_ref_t
 {
@@ -70,6 +86,23 @@ public:
     // as opposed to reset after wait)
     void reset();
 
+#if defined(_WIN32) || defined(__linux__)
+    // The underlying HANDLE on Windows. On Linux, the handle encodes the
+    // eventfd (see fd) and whether the event is manually reset.
+    void* handle() const noexcept
+    {
+        return handle_;
+    }
+#endif
+
+#if defined(__linux__)
+    // The underlying eventfd
+    int fd() const noexcept
+    {
+        return static_cast<int>(reinterpret_cast<uintptr_t>(handle_) >> 1) - 1;
+    }
+#endif
+
 protected:
     friend class event_t;
 
@@ -80,6 +113,41 @@ protected:
 #endif
 };
 
+namespace detail
+{
+    // Suspends the coroutine until the event is signaled, then schedules it
+    // on the default scheduler with the supplied affinity and priority
+    class COOP_API event_awaiter_t : event_waiter_t
+    {
+    public:
+        event_awaiter_t(event_ref_t event,
+                        cpu_mask_t cpu_affinity,
+                        uint32_t priority) noexcept;
+        event_awaiter_t(event_awaiter_t const&) = delete;
+        event_awaiter_t& operator=(event_awaiter_t const&) = delete;
+
+        bool await_ready() const
+        {
+            return event_.is_signaled();
+        }
+
+        bool await_suspend(std::coroutine_handle<> coroutine) noexcept;
+
+        // True once the event is signaled, or false if the event couldn't be
+        // awaited (e.g. if the reactor failed to register it)
+        bool await_resume() const noexcept
+        {
+            return signaled_;
+        }
+
+    private:
+        event_ref_t event_;
+        cpu_mask_t cpu_affinity_;
+        uint32_t priority_;
+        bool signaled_ = true;
+    };
+} // namespace detail
+
 class COOP_API event_t final : public event_ref_t
 {
 public:
@@ -102,9 +170,9 @@ public:
 
     // The CPU affinity and priority set here are used to consider the
     // *continuation* after this event is signaled
-    void set_cpu_affinity(uint32_t affinity) noexcept
+    void set_cpu_affinity(cpu_mask_t affinity) noexcept
     {
-        cpu_affinity_ = affinity;
+        cpu_affinity_ = std::move(affinity);
     }
 
     void set_priority(uint32_t priority) noexcept
@@ -112,22 +180,15 @@ public:
         priority_ = priority;
     }
 
-    // Awaiter traits
-    bool await_ready() const noexcept
+    // Awaiting the event suspends the coroutine until the event is signaled,
+    // producing true once it is, or false if it couldn't be awaited
+    detail::event_awaiter_t operator co_await() const noexcept
     {
-        return is_signaled();
+        return {ref(), cpu_affinity_, priority_};
     }
 
-    void await_resume() const noexcept
-    {
-    }
-
-    // Enqueue coroutine for resumption when this event transitions to the
-    // signaled state
-    void await_suspend(std::coroutine_handle<> coroutine) noexcept;
-
 private:
-    uint64_t cpu_affinity_ = 0;
+    cpu_mask_t cpu_affinity_;
     uint32_t priority_     = 0;
 };
 } // namespace coop
\ No newline at end of file
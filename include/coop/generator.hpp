@@ -0,0 +1,205 @@
+#pragma once
+
+#include "detail/promise.hpp"
+#include <memory>
+#if defined(__clang__)
+#    include <experimental/coroutine>
+namespace std
+{
+using experimental::coroutine_handle;
+}
+#else
+#    include <coroutine>
+#endif
+
+namespace coop
+{
+template <typename T>
+class async_generator_t;
+
+namespace detail
+{
+    // The producer and consumer of a generator take turns: the consumer is
+    // suspended while the producer runs (possibly suspending onto other
+    // threads) until it yields, and the producer stays suspended at the yield
+    // until the consumer asks for the next value. Control passes between them
+    // through symmetric transfer, so no synchronization is needed.
+    template <typename T>
+    struct generator_promise_t : public promise_frame_t
+    {
+        // Points into the producer's frame while it's suspended at a yield
+        T* value = nullptr;
+
+        std::coroutine_handle<> consumer = nullptr;
+
+        struct yield_awaiter_t
+        {
+            generator_promise_t& promise;
+
+            bool await_ready() const noexcept
+            {
+                return false;
+            }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<>) const noexcept
+            {
+                return promise.consumer;
+            }
+
+            void await_resume() const noexcept
+            {
+            }
+        };
+
+        struct final_awaiter_t
+        {
+            bool await_ready() const noexcept
+            {
+                return false;
+            }
+
+            std::coroutine_handle<>
+            await_suspend(std::coroutine_handle<generator_promise_t> coroutine) const noexcept
+            {
+                generator_promise_t& promise = coroutine.promise();
+                promise.value = nullptr;
+                return promise.consumer;
+            }
+
+            void await_resume() const noexcept
+            {
+            }
+        };
+
+        async_generator_t<T> get_return_object() noexcept
+        {
+            return {std::coroutine_handle<generator_promise_t>::from_promise(*this)};
+        }
+
+        // The producer doesn't run until the first value is requested
+        std::suspend_always initial_suspend() const noexcept
+        {
+            return {};
+        }
+
+        // Values (including temporaries, which live until the producer is
+        // resumed) are handed to the consumer by address rather than copied
+        yield_awaiter_t yield_value(T& value) noexcept
+        {
+            this->value = std::addressof(value);
+            return {*this};
+        }
+
+        yield_awaiter_t yield_value(T&& value) noexcept
+        {
+            this->value = std::addressof(value);
+            return {*this};
+        }
+
+        void return_void() noexcept
+        {
+        }
+
+        final_awaiter_t final_suspend() noexcept
+        {
+            return {};
+        }
+    };
+} // namespace detail
+
+// A coroutine producing a sequence of values asynchronously. The producer
+// `co_yield`s values, and the consumer awaits them one at a time:
+//
+//     coop::async_generator_t<record_t> read_records(int fd)
+//     {
+//         record_t record;
+//         while (co_await read_record(fd, record))
+//         {
+//             co_yield record;
+//         }
+//     }
+//
+//     auto records = read_records(fd);
+//     while (record_t* record = co_await records.next())
+//     {
+//         ...
+//     }
+//
+// The producer only runs while the consumer awaits the next value, so it can
+// never get ahead of the consumer by more than one value. The consumer
+// receives a pointer to the yielded value in the producer's frame, which
+// remains valid until it awaits the next value.
+template <typename T>
+class async_generator_t
+{
+public:
+    using promise_type = detail::generator_promise_t<T>;
+
+    async_generator_t() noexcept = default;
+    async_generator_t(std::coroutine_handle<promise_type> coroutine) noexcept
+        : coroutine_{coroutine}
+    {
+    }
+    async_generator_t(async_generator_t const&) = delete;
+    async_generator_t& operator=(async_generator_t const&) = delete;
+    async_generator_t(async_generator_t&& other) noexcept
+        : coroutine_{other.coroutine_}
+    {
+        other.coroutine_ = nullptr;
+    }
+    async_generator_t& operator=(async_generator_t&& other) noexcept
+    {
+        if (this != &other)
+        {
+            if (coroutine_)
+            {
+                coroutine_.destroy();
+            }
+            coroutine_       = other.coroutine_;
+            other.coroutine_ = nullptr;
+        }
+        return *this;
+    }
+    // The generator must not be destroyed while the next value is awaited
+    ~async_generator_t() noexcept
+    {
+        if (coroutine_)
+        {
+            coroutine_.destroy();
+        }
+    }
+
+    struct next_awaiter_t
+    {
+        std::coroutine_handle<promise_type> coroutine;
+
+        bool await_ready() const noexcept
+        {
+            return !coroutine || coroutine.done();
+        }
+
+        // Resumes the producer until it yields or completes
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> consumer) const noexcept
+        {
+            coroutine.promise().consumer = consumer;
+            return coroutine;
+        }
+
+        T* await_resume() const noexcept
+        {
+            return coroutine ? coroutine.promise().value : nullptr;
+        }
+    };
+
+    // Resumes the producer, and suspends the current coroutine until the next
+    // value is yielded. Awaiting the returned value produces a pointer to the
+    // value, or nullptr once the producer completes.
+    next_awaiter_t next() noexcept
+    {
+        return {coroutine_};
+    }
+
+private:
+    std::coroutine_handle<promise_type> coroutine_ = nullptr;
+};
+} // namespace coop
@@ -0,0 +1,461 @@
+#pragma once
+
+#if defined(__linux__)
+
+#    include "cpu_mask.hpp"
+#    include "detail/api.hpp"
+#    include "detail/concurrentqueue.h"
+#    include "scheduler.hpp"
+#    include "source_location.hpp"
+#    include <atomic>
+#    include <cassert>
+#    include <cstddef>
+#    include <cstdint>
+#    include <mutex>
+#    include <semaphore>
+#    include <sys/types.h>
+#    include <thread>
+#    if defined(__clang__)
+#        include <experimental/coroutine>
+namespace std
+{
+using experimental::coroutine_handle;
+}
+#    else
+#        include <coroutine>
+#    endif
+
+namespace coop
+{
+namespace detail
+{
+    // An asynchronous file operation. Operations are owned by the caller
+    // (typically embedded in an awaiter within a suspended coroutine frame)
+    // and passed to io_uring as user data.
+    struct io_op_t
+    {
+        enum class opcode_e : uint8_t
+        {
+            read,
+            write,
+            // As above, but the buffer lies within the registered buffer
+            // region identified by `buffer_index`
+            read_fixed,
+            write_fixed,
+        };
+
+        // Invoked on the completion thread with `result` set. The operation
+        // is no longer referenced by the I/O service when this is called.
+        void (*complete)(io_op_t* op) = nullptr;
+
+        opcode_e opcode = opcode_e::read;
+        int fd       = -1;
+        void* buffer = nullptr;
+        uint32_t size         = 0;
+        uint32_t buffer_index = 0;
+        uint64_t offset       = 0;
+
+        // The number of bytes transferred, or a negated errno value
+        int32_t result = 0;
+    };
+
+    // A buffer within a registered region, linked into a free list while it
+    // isn't leased
+    struct io_buffer_node_t
+    {
+        io_buffer_node_t* next = nullptr;
+        void* data             = nullptr;
+
+        // The registered region containing the buffer, which is allocated on
+        // a single NUMA node
+        uint32_t region = 0;
+    };
+} // namespace detail
+
+class io_service_t;
+
+// A buffer leased from an io_service_t's pool of registered buffers, which
+// returns to the pool when destroyed. Reading into or writing from a leased
+// buffer avoids the per-operation cost of pinning the buffer's pages.
+class COOP_API io_buffer_t
+{
+public:
+    io_buffer_t() noexcept = default;
+    ~io_buffer_t() noexcept;
+    io_buffer_t(io_buffer_t const&) = delete;
+    io_buffer_t& operator=(io_buffer_t const&) = delete;
+    io_buffer_t(io_buffer_t&& other) noexcept;
+    io_buffer_t& operator=(io_buffer_t&& other) noexcept;
+
+    // An io_buffer_t is truthy if it holds a leased buffer
+    explicit operator bool() const noexcept
+    {
+        return node_ != nullptr;
+    }
+
+    void* data() const noexcept
+    {
+        return node_->data;
+    }
+
+    uint32_t size() const noexcept;
+
+    io_service_t& service() const noexcept
+    {
+        return *service_;
+    }
+
+    // The index of the registered region containing the buffer
+    uint32_t index() const noexcept
+    {
+        return node_->region;
+    }
+
+private:
+    friend class io_service_t;
+
+    io_buffer_t(io_service_t* service, detail::io_buffer_node_t* node) noexcept
+        : service_{service}
+        , node_{node}
+    {
+    }
+
+    io_service_t* service_          = nullptr;
+    detail::io_buffer_node_t* node_ = nullptr;
+};
+
+// Performs file reads and writes asynchronously with io_uring. Submissions
+// from any thread are appended to the submission ring and flushed to the
+// kernel in batches by a dedicated completion thread, which also reaps
+// completions and invokes their callbacks.
+//
+// If io_uring is unavailable (e.g. on older kernels or when disabled by a
+// seccomp policy), operations are instead performed with blocking pread and
+// pwrite calls on the completion thread, which still keeps them off the
+// worker threads.
+class COOP_API io_service_t
+{
+public:
+    // Returns the I/O service used by coop::read and coop::write
+    static io_service_t& instance() noexcept;
+
+    // `entries` is the size of the submission ring. Passing false for
+    // `use_io_uring` forces the fallback implementation.
+    explicit io_service_t(uint32_t entries = 256, bool use_io_uring = true);
+    ~io_service_t() noexcept;
+    io_service_t(io_service_t const&) = delete;
+    io_service_t(io_service_t&&)      = delete;
+    io_service_t& operator=(io_service_t const&) = delete;
+    io_service_t& operator=(io_service_t&&) = delete;
+
+    // The operation must remain valid until its completion callback is
+    // invoked
+    void submit(detail::io_op_t* op);
+
+    // True if operations are performed with io_uring
+    bool uses_io_uring() const noexcept
+    {
+        return ring_fd_ >= 0;
+    }
+
+    // Allocates a pool of `count` buffers of `size` bytes (rounded up to a
+    // multiple of the page size) on each NUMA node spanned by the scheduler's
+    // workers, and registers each node's buffers with the ring. Each worker
+    // keeps a small free list of buffers from its own node, so leasing and
+    // releasing a buffer on a worker is usually a pointer swap. May only be
+    // called once. Returns false if the buffers couldn't be allocated, in
+    // which case nothing is left allocated and the call may be retried. If
+    // they can't be registered (e.g. due to RLIMIT_MEMLOCK), the pool still works
+    // but operations on its buffers don't use fixed buffers.
+    bool register_buffers(uint32_t size,
+                          uint32_t count,
+                          scheduler_t& scheduler = scheduler_t::instance());
+
+    // Leases a buffer, preferring the calling worker's free list followed by
+    // the buffers of its NUMA node. Returns an empty buffer if none are
+    // available.
+    io_buffer_t lease_buffer() noexcept;
+
+    // The size of each buffer in the pool
+    uint32_t buffer_size() const noexcept
+    {
+        return buffer_size_;
+    }
+
+    // True if buffers in the pool are registered with the ring
+    bool buffers_registered() const noexcept
+    {
+        return buffers_registered_;
+    }
+
+private:
+    friend class io_buffer_t;
+
+    struct buffer_region_t;
+
+    // A worker's free list, padded to avoid false sharing between workers
+    struct alignas(64) buffer_list_t
+    {
+        detail::io_buffer_node_t* head = nullptr;
+        uint32_t size                  = 0;
+        // The region of the worker's NUMA node
+        uint32_t region = 0;
+    };
+
+    bool setup(uint32_t entries);
+
+    // Unmaps and destroys the buffer regions, so that registration may be
+    // retried after a failure
+    void release_buffers() noexcept;
+
+    // Returns the free list of the calling worker if it belongs to the
+    // scheduler the buffers were registered for
+    buffer_list_t* local_buffers() const noexcept;
+
+    // Returns the region allocated on the given NUMA node, or the first region
+    // if there isn't one
+    uint32_t region(uint32_t node) const noexcept;
+
+    void release(detail::io_buffer_node_t* buffer) noexcept;
+
+    // Returns the tail of the submission ring once it has room for an SQE
+    // (requires the lock)
+    uint32_t reserve() noexcept;
+
+    // Appends an SQE to the submission ring (requires the lock)
+    void push(detail::io_op_t* op) noexcept;
+
+    // Appends a poll of the wake event to the submission ring (requires the
+    // lock)
+    void push_wake() noexcept;
+
+    // Submits all SQEs appended since the last flush (requires the lock)
+    void flush() noexcept;
+
+    void run_ring() noexcept;
+    void run_fallback() noexcept;
+
+    std::thread thread_;
+    std::atomic<bool> active_;
+
+    int ring_fd_ = -1;
+    std::mutex mutex_;
+    uint32_t unsubmitted_ = 0;
+
+    // Set while a wakeup of the completion thread is outstanding, so that
+    // submitters only signal the wake event once per batch
+    std::atomic<bool> wake_pending_;
+    int wake_fd_ = -1;
+
+    // Mapped ring memory
+    void* sq_ring_       = nullptr;
+    size_t sq_ring_size_ = 0;
+    void* cq_ring_       = nullptr;
+    size_t cq_ring_size_ = 0;
+    void* sqes_          = nullptr;
+    size_t sqes_size_    = 0;
+    uint32_t* sq_head_   = nullptr;
+    uint32_t* sq_tail_   = nullptr;
+    uint32_t* sq_array_  = nullptr;
+    uint32_t sq_mask_    = 0;
+    uint32_t sq_entries_ = 0;
+    uint32_t* cq_head_   = nullptr;
+    uint32_t* cq_tail_   = nullptr;
+    void* cqes_          = nullptr;
+    uint32_t cq_mask_    = 0;
+
+    // Used by the fallback implementation
+    moodycamel::ConcurrentQueue<detail::io_op_t*> fallback_queue_;
+    std::counting_semaphore<> fallback_sem_{0};
+
+    // Registered buffers, with one region per NUMA node
+    scheduler_t* buffer_scheduler_          = nullptr;
+    uint32_t buffer_size_                   = 0;
+    bool buffers_registered_                = false;
+    buffer_region_t* regions_               = nullptr;
+    uint32_t region_count_                  = 0;
+    detail::io_buffer_node_t* buffer_nodes_ = nullptr;
+
+    // Free lists indexed by worker ID, along with the maximum number of
+    // buffers each may hold
+    buffer_list_t* buffer_lists_ = nullptr;
+    uint32_t buffer_list_limit_  = 0;
+};
+
+inline uint32_t io_buffer_t::size() const noexcept
+{
+    return service_->buffer_size();
+}
+
+namespace detail
+{
+    template <Scheduler S>
+    class io_awaiter_t : io_op_t
+    {
+    public:
+        io_awaiter_t(io_service_t& service,
+                     opcode_e opcode,
+                     int fd,
+                     void* buffer,
+                     uint32_t size,
+                     uint32_t buffer_index,
+                     uint64_t offset,
+                     S& scheduler,
+                     cpu_mask_t cpu_mask,
+                     uint32_t priority,
+                     source_location_t source_location) noexcept
+            : service_{service}
+            , scheduler_{scheduler}
+            , cpu_mask_{std::move(cpu_mask)}
+            , priority_{priority}
+            , source_location_{source_location}
+        {
+            this->opcode       = opcode;
+            this->fd           = fd;
+            this->buffer       = buffer;
+            this->size         = size;
+            this->buffer_index = buffer_index;
+            this->offset       = offset;
+            complete     = [](io_op_t* op) {
+                auto& self = *static_cast<io_awaiter_t*>(op);
+                self.scheduler_.schedule(self.coroutine_,
+                                         self.cpu_mask_,
+                                         self.priority_,
+                                         self.source_location_);
+            };
+        }
+
+        io_awaiter_t(io_awaiter_t const&) = delete;
+        io_awaiter_t& operator=(io_awaiter_t const&) = delete;
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> coroutine)
+        {
+            coroutine_ = coroutine;
+            service_.submit(this);
+        }
+
+        // Returns the number of bytes transferred, or a negated errno value
+        ssize_t await_resume() const noexcept
+        {
+            return result;
+        }
+
+    private:
+        io_service_t& service_;
+        S& scheduler_;
+        cpu_mask_t cpu_mask_;
+        uint32_t priority_;
+        source_location_t source_location_;
+        std::coroutine_handle<> coroutine_;
+    };
+} // namespace detail
+
+// Reads up to `size` bytes from the file at `offset` without blocking the
+// calling worker. Once the read completes, the coroutine is scheduled with the
+// supplied affinity and priority. Awaiting the returned value produces the
+// number of bytes read, or a negated errno value on failure.
+template <Scheduler S = scheduler_t>
+inline auto read(int fd,
+                 void* buffer,
+                 uint32_t size,
+                 uint64_t offset,
+                 S& scheduler                             = S::instance(),
+                 cpu_mask_t cpu_mask                      = {},
+                 uint32_t priority                        = 0,
+                 source_location_t const& source_location = {}) noexcept
+{
+    return detail::io_awaiter_t<S>{io_service_t::instance(),
+                                   detail::io_op_t::opcode_e::read,
+                                   fd,
+                                   buffer,
+                                   size,
+                                   0,
+                                   offset,
+                                   scheduler,
+                                   std::move(cpu_mask),
+                                   priority,
+                                   source_location};
+}
+
+// As above, but writes up to `size` bytes to the file at `offset`
+template <Scheduler S = scheduler_t>
+inline auto write(int fd,
+                  void const* buffer,
+                  uint32_t size,
+                  uint64_t offset,
+                  S& scheduler                             = S::instance(),
+                  cpu_mask_t cpu_mask                      = {},
+                  uint32_t priority                        = 0,
+                  source_location_t const& source_location = {}) noexcept
+{
+    return detail::io_awaiter_t<S>{io_service_t::instance(),
+                                   detail::io_op_t::opcode_e::write,
+                                   fd,
+                                   const_cast<void*>(buffer),
+                                   size,
+                                   0,
+                                   offset,
+                                   scheduler,
+                                   std::move(cpu_mask),
+                                   priority,
+                                   source_location};
+}
+
+// Reads up to `size` bytes into a buffer leased from the I/O service's pool of
+// registered buffers, which avoids pinning the buffer for each read
+template <Scheduler S = scheduler_t>
+inline auto read(int fd,
+                 io_buffer_t& buffer,
+                 uint32_t size,
+                 uint64_t offset,
+                 S& scheduler                             = S::instance(),
+                 cpu_mask_t cpu_mask                      = {},
+                 uint32_t priority                        = 0,
+                 source_location_t const& source_location = {}) noexcept
+{
+    assert(buffer && size <= buffer.size() && "Read exceeds the leased buffer");
+    return detail::io_awaiter_t<S>{buffer.service(),
+                                   detail::io_op_t::opcode_e::read_fixed,
+                                   fd,
+                                   buffer.data(),
+                                   size,
+                                   buffer.index(),
+                                   offset,
+                                   scheduler,
+                                   std::move(cpu_mask),
+                                   priority,
+                                   source_location};
+}
+
+// As above, but writes up to `size` bytes from a leased buffer
+template <Scheduler S = scheduler_t>
+inline auto write(int fd,
+                  io_buffer_t const& buffer,
+                  uint32_t size,
+                  uint64_t offset,
+                  S& scheduler                             = S::instance(),
+                  cpu_mask_t cpu_mask                      = {},
+                  uint32_t priority                        = 0,
+                  source_location_t const& source_location = {}) noexcept
+{
+    assert(buffer && size <= buffer.size() && "Write exceeds the leased buffer");
+    return detail::io_awaiter_t<S>{buffer.service(),
+                                   detail::io_op_t::opcode_e::write_fixed,
+                                   fd,
+                                   buffer.data(),
+                                   size,
+                                   buffer.index(),
+                                   offset,
+                                   scheduler,
+                                   std::move(cpu_mask),
+                                   priority,
+                                   source_location};
+}
+} // namespace coop
+
+#endif
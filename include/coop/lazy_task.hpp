@@ -0,0 +1,119 @@
+#pragma once
+
+#include "detail/promise.hpp"
+#include <functional>
+#include <type_traits>
+#include <utility>
+#if defined(__clang__)
+#    include <experimental/coroutine>
+namespace std
+{
+using experimental::coroutine_handle;
+}
+#else
+#    include <coroutine>
+#endif
+
+namespace coop
+{
+// A task that doesn't start until it's awaited. Awaiting it transfers control
+// directly into its coroutine on the awaiting thread, and its completion
+// transfers control directly back, so neither side performs the atomic
+// handshake needed by eager tasks (which may complete on another thread while
+// the awaiting coroutine is still suspending). This makes lazy tasks well
+// suited to small helper coroutines that are called and awaited immediately:
+//
+//     coop::lazy_task_t<int> parse_header(buffer_t const& buffer);
+//
+//     coop::task_t<> handle(buffer_t buffer)
+//     {
+//         int length = co_await parse_header(buffer);
+//         ...
+//     }
+//
+// A lazy task that is never awaited never runs, and its frame is destroyed
+// along with the lazy_task_t.
+template <typename T = void>
+class lazy_task_t
+{
+public:
+    using promise_type = detail::lazy_promise_t<lazy_task_t, T>;
+
+    lazy_task_t() noexcept = default;
+    lazy_task_t(std::coroutine_handle<promise_type> coroutine) noexcept
+        : coroutine_{coroutine}
+    {
+    }
+    lazy_task_t(lazy_task_t const&) = delete;
+    lazy_task_t& operator=(lazy_task_t const&) = delete;
+    lazy_task_t(lazy_task_t&& other) noexcept
+        : coroutine_{other.coroutine_}
+    {
+        other.coroutine_ = nullptr;
+    }
+    lazy_task_t& operator=(lazy_task_t&& other) noexcept
+    {
+        if (this != &other)
+        {
+            if (coroutine_)
+            {
+                coroutine_.destroy();
+            }
+            coroutine_       = other.coroutine_;
+            other.coroutine_ = nullptr;
+        }
+        return *this;
+    }
+    ~lazy_task_t() noexcept
+    {
+        if (coroutine_)
+        {
+            coroutine_.destroy();
+        }
+    }
+
+    // The dereferencing operators below return the data contained in the
+    // associated promise, once the task has been awaited
+    [[nodiscard]] auto operator*() noexcept
+    {
+        static_assert(
+            !std::is_same_v<T, void>, "This task doesn't contain any data");
+        return std::ref(coroutine_.promise().data);
+    }
+
+    [[nodiscard]] auto operator*() const noexcept
+    {
+        static_assert(
+            !std::is_same_v<T, void>, "This task doesn't contain any data");
+        return std::cref(coroutine_.promise().data);
+    }
+
+    [[nodiscard]] bool await_ready() const noexcept
+    {
+        return !coroutine_ || coroutine_.done();
+    }
+
+    // Starts the coroutine, which resumes the awaiting coroutine when it
+    // completes
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> coroutine) noexcept
+    {
+        coroutine_.promise().continuation = coroutine;
+        return coroutine_;
+    }
+
+    auto await_resume() const noexcept
+    {
+        if constexpr (std::is_same_v<T, void>)
+        {
+            return;
+        }
+        else
+        {
+            return std::move(coroutine_.promise().data);
+        }
+    }
+
+private:
+    std::coroutine_handle<promise_type> coroutine_ = nullptr;
+};
+} // namespace coop
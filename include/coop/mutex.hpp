@@ -0,0 +1,195 @@
+#pragma once
+
+#include "cpu_mask.hpp"
+#include "detail/api.hpp"
+#include "detail/async_counter.hpp"
+#include "scheduler.hpp"
+#include "source_location.hpp"
+#include <atomic>
+#include <cstdint>
+#include <utility>
+#if defined(__clang__)
+#    include <experimental/coroutine>
+namespace std
+{
+using experimental::coroutine_handle;
+}
+#else
+#    include <coroutine>
+#endif
+
+namespace coop
+{
+// Determines how a suspended waiter is resumed when a lock is handed to it
+enum class handoff_e : uint32_t
+{
+    // The waiter is scheduled with the affinity and priority it awaited with
+    schedule,
+    // The waiter is resumed on the unlocking thread before unlock returns
+    immediate
+};
+
+class async_mutex_t;
+
+// Unlocks a mutex locked with async_mutex_t::scoped_lock when destroyed
+class async_lock_t
+{
+public:
+    async_lock_t() noexcept = default;
+    explicit async_lock_t(async_mutex_t& mutex) noexcept
+        : mutex_{&mutex}
+    {
+    }
+    async_lock_t(async_lock_t const&) = delete;
+    async_lock_t& operator=(async_lock_t const&) = delete;
+    async_lock_t(async_lock_t&& other) noexcept
+        : mutex_{std::exchange(other.mutex_, nullptr)}
+    {
+    }
+    async_lock_t& operator=(async_lock_t&& other) noexcept;
+    ~async_lock_t() noexcept;
+
+    void unlock(handoff_e handoff = handoff_e::schedule) noexcept;
+
+private:
+    async_mutex_t* mutex_ = nullptr;
+};
+
+// A mutex for coroutines. Locking a held mutex suspends the coroutine rather
+// than blocking its worker, and waiters acquire the mutex in the order they
+// arrived: unlocking hands the mutex directly to the next waiter, so a
+// coroutine that repeatedly unlocks and relocks can't barge ahead of it.
+//
+//     coop::async_mutex_t mutex;
+//
+//     co_await mutex.lock();
+//     ...
+//     mutex.unlock();
+//
+//     // Or, unlocked when the guard goes out of scope
+//     coop::async_lock_t guard = co_await mutex.scoped_lock();
+class COOP_API async_mutex_t
+{
+public:
+    async_mutex_t() noexcept = default;
+    ~async_mutex_t() noexcept;
+    async_mutex_t(async_mutex_t const&) = delete;
+    async_mutex_t& operator=(async_mutex_t const&) = delete;
+
+    template <Scheduler S, bool Scoped>
+    class lock_awaiter_t : detail::scheduled_waiter_t<S>
+    {
+    public:
+        lock_awaiter_t(async_mutex_t& mutex,
+                       S& scheduler,
+                       cpu_mask_t cpu_mask,
+                       uint32_t priority,
+                       source_location_t source_location) noexcept
+            : detail::scheduled_waiter_t<S>{scheduler,
+                                            std::move(cpu_mask),
+                                            priority,
+                                            source_location}
+            , mutex_{mutex}
+        {
+        }
+
+        lock_awaiter_t(lock_awaiter_t const&) = delete;
+        lock_awaiter_t& operator=(lock_awaiter_t const&) = delete;
+
+        bool await_ready() noexcept
+        {
+            return mutex_.try_lock();
+        }
+
+        bool await_suspend(std::coroutine_handle<> coroutine) noexcept
+        {
+            this->coroutine = coroutine;
+            return mutex_.lock_or_wait(*this);
+        }
+
+        // The mutex is held by the time the coroutine resumes
+        auto await_resume() noexcept
+        {
+            if constexpr (Scoped)
+            {
+                return async_lock_t{mutex_};
+            }
+        }
+
+    private:
+        async_mutex_t& mutex_;
+    };
+
+    // Locks the mutex, suspending while it's held. Remember to `co_await`
+    // this function's returned value.
+    template <Scheduler S = scheduler_t>
+    lock_awaiter_t<S, false> lock(S& scheduler                             = S::instance(),
+                                  cpu_mask_t cpu_mask                      = {},
+                                  uint32_t priority                        = 0,
+                                  source_location_t const& source_location = {}) noexcept
+    {
+        return {*this, scheduler, std::move(cpu_mask), priority, source_location};
+    }
+
+    // As above, but awaiting the returned value produces an async_lock_t
+    // which unlocks the mutex when destroyed
+    template <Scheduler S = scheduler_t>
+    lock_awaiter_t<S, true>
+    scoped_lock(S& scheduler                             = S::instance(),
+                cpu_mask_t cpu_mask                      = {},
+                uint32_t priority                        = 0,
+                source_location_t const& source_location = {}) noexcept
+    {
+        return {*this, scheduler, std::move(cpu_mask), priority, source_location};
+    }
+
+    bool try_lock() noexcept
+    {
+        uintptr_t state = unlocked;
+        return state_.compare_exchange_strong(
+            state, locked, std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    // Releases the mutex, handing it to the longest waiting coroutine if any
+    void unlock(handoff_e handoff = handoff_e::schedule) noexcept;
+
+private:
+    constexpr static uintptr_t unlocked = 0;
+    constexpr static uintptr_t locked   = 1;
+
+    // Acquires the mutex if it's unlocked, returning false. Otherwise, pushes
+    // the waiter and returns true.
+    bool lock_or_wait(detail::waiter_t& waiter) noexcept;
+
+    // Unlocked, locked, or the most recent of the waiters that arrived since
+    // the holder last took them (linked from newest to oldest)
+    std::atomic<uintptr_t> state_ = unlocked;
+
+    // Waiters taken from the state by a holder, oldest first. Only accessed
+    // by the holder.
+    detail::waiter_t* waiters_ = nullptr;
+};
+
+inline async_lock_t& async_lock_t::operator=(async_lock_t&& other) noexcept
+{
+    if (this != &other)
+    {
+        unlock();
+        mutex_ = std::exchange(other.mutex_, nullptr);
+    }
+    return *this;
+}
+
+inline async_lock_t::~async_lock_t() noexcept
+{
+    unlock();
+}
+
+inline void async_lock_t::unlock(handoff_e handoff) noexcept
+{
+    if (mutex_)
+    {
+        std::exchange(mutex_, nullptr)->unlock(handoff);
+    }
+}
+} // namespace coop
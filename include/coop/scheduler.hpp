@@ -1,10 +1,15 @@
 #pragma once
 
+#include "cpu_mask.hpp"
+#include "deadline.hpp"
 #include "detail/api.hpp"
 #include "detail/concurrentqueue.h"
+#include "detail/reactor.hpp"
 #include "detail/work_queue.hpp"
 #include "event.hpp"
 #include "source_location.hpp"
+#include "topology.hpp"
+#include <algorithm>
 #include <atomic>
 #if defined(__clang__)
 #    include <experimental/coroutine>
@@ -17,6 +22,7 @@ using experimental::coroutine_handle;
 #endif
 #include <cstdint>
 #include <thread>
+#include <vector>
 
 namespace coop
 {
@@ -25,21 +31,102 @@ class event_ref_t;
 template <typename S>
 concept Scheduler = requires(S scheduler,
                              std::coroutine_handle<> coroutine,
-                             uint64_t cpu_affinity,
+                             cpu_mask_t cpu_affinity,
                              uint32_t priority,
                              source_location_t source_location)
 {
     scheduler.schedule(coroutine, cpu_affinity, priority, source_location);
 };
 
+// Determines how worker threads are bound to the CPUs they're assigned
+enum class pinning_e : uint32_t
+{
+    // Each worker is bound to exactly one CPU
+    hard,
+    // Each worker is bound to the scheduler CPUs sharing a last-level cache
+    // with its assigned CPU, so the OS may migrate it within that domain
+    soft,
+    // Workers aren't bound to any CPU. Affinity masks still refer to the CPUs
+    // workers are nominally assigned.
+    none
+};
+
+struct COOP_API scheduler_config_t
+{
+    // The number of worker threads to spawn. Zero spawns one worker per CPU
+    // in `cpus`, limited to the process's cgroup CPU quota (see
+    // topology_t::cpu_quota). With hard or soft pinning, at most one worker is
+    // spawned per CPU. Unpinned workers in excess of the CPU count are
+    // assigned virtual CPU indices following the highest CPU in `cpus`.
+    uint32_t worker_count = 0;
+
+    // The CPUs assigned to workers, in ascending order. An empty mask uses the
+    // CPUs the process may run on (see topology_t::available_cpus). With hard
+    // or soft pinning, CPUs the process may not run on are removed.
+    cpu_mask_t cpus;
+
+    pinning_e pinning = pinning_e::hard;
+
+    // The initial capacity of each worker queue, per priority. This is also
+    // the capacity of the deque used for coroutines a worker schedules onto
+    // itself, which cannot grow.
+    size_t queue_capacity = 256;
+
+    // The number of priority levels (at least one). Priorities passed to
+    // scheduler_t::schedule are clamped to [0, priority_count), with higher
+    // values being higher priority.
+    uint32_t priority_count = 2;
+
+    // The weight of each priority level, indexed by priority. While several
+    // levels have work, each worker runs up to `weight` coroutines from each
+    // level per round, visiting higher priorities first, so a level's share of
+    // a busy worker is its weight relative to the total and no level is
+    // starved. Levels without a weight here default to 4^priority (i.e. each
+    // level runs four coroutines for every one of the level below), and
+    // weights of zero are treated as one.
+    std::vector<uint32_t> priority_weights;
+
+    // Returns `config` with any of the following environment variables
+    // applied:
+    //
+    // COOP_WORKER_COUNT: a worker count (e.g. "8")
+    // COOP_CPUS: a CPU list (e.g. "0-3,8,10-11")
+    // COOP_PINNING: "hard", "soft", or "none"
+    // COOP_QUEUE_CAPACITY: a queue capacity (e.g. "1024")
+    // COOP_PRIORITY_COUNT: a priority level count (e.g. "3")
+    // COOP_PRIORITY_WEIGHTS: comma separated weights, lowest priority first
+    //                        (e.g. "1,8,64")
+    static scheduler_config_t from_environment(scheduler_config_t config);
+
+    static scheduler_config_t from_environment()
+    {
+        return from_environment(scheduler_config_t{});
+    }
+
+    // The number of workers spawned for a zero `worker_count`, given the
+    // number of CPUs in `cpus` and the cgroup CPU quota (zero if unlimited).
+    // At least one worker is always spawned.
+    static uint32_t default_worker_count(uint32_t cpu_count, uint32_t cpu_quota) noexcept
+    {
+        uint32_t out = cpu_quota != 0 && cpu_quota < cpu_count ? cpu_quota : cpu_count;
+        return std::max(out, 1u);
+    }
+};
+
 // Implement the Scheduler concept above to use your own coroutine scheduler
 class COOP_API scheduler_t final
 {
 public:
-    // Returns the default global threadsafe scheduler
+    // Returns the default global threadsafe scheduler, which is configured
+    // from the environment (see scheduler_config_t::from_environment)
     static scheduler_t& instance() noexcept;
 
+    // Equivalent to constructing the scheduler with
+    // scheduler_config_t::from_environment()
     scheduler_t();
+
+    // The configuration is used as is (environment variables are ignored)
+    explicit scheduler_t(scheduler_config_t const& config);
     ~scheduler_t() noexcept;
     scheduler_t(scheduler_t const&) = delete;
     scheduler_t(scheduler_t&&)      = delete;
@@ -52,30 +139,135 @@ public:
     // runtime behavior.
     //
     // In addition, you are free to handle or ignore the cpu affinity and
-    // priority parameters differently. The default scheduler here supports TWO
-    // priorities: 0 and 1. Coroutines with priority 1 will (in a best-effort
-    // sense), be scheduled ahead of coroutines with priority 0.
+    // priority parameters differently. The default scheduler here supports
+    // the number of priorities it was configured with (two by default: 0 and
+    // 1). Coroutines with higher priorities are run more often than those
+    // with lower priorities in proportion to the configured priority weights.
     void schedule(std::coroutine_handle<> coroutine,
-                  uint64_t cpu_affinity             = 0,
+                  cpu_mask_t cpu_affinity           = {},
                   uint32_t priority                 = 0,
                   source_location_t source_location = {});
 
+    // Schedules a coroutine to be run in earliest-deadline-first order.
+    // Coroutines with deadlines are run ahead of all coroutines scheduled by
+    // priority, so a continuous stream of them delays prioritized work. The
+    // deadline only determines the order in which a worker runs queued
+    // coroutines; a coroutine is never preempted or dropped when its deadline
+    // passes.
+    //
+    // Custom schedulers may optionally implement this overload. Suspending
+    // with a deadline on a scheduler that doesn't schedules the coroutine
+    // with priority 0 instead.
     void schedule(std::coroutine_handle<> coroutine,
-                  event_ref_t event,
-                  uint64_t cpu_affinity,
-                  uint32_t priority);
+                  deadline_t deadline,
+                  cpu_mask_t cpu_affinity           = {},
+                  source_location_t source_location = {});
+
+    // Queues the waiter until the event is signaled, at which point its wake
+    // function is invoked (typically scheduling its coroutine). The waiter
+    // must remain valid until then. Returns false (with errno set) if the
+    // event can't be awaited, in which case the waiter isn't queued.
+    //
+    // On Linux, the event is registered with an epoll reactor the first time
+    // it's awaited, and waiting neither allocates nor consumes a descriptor,
+    // so any number of coroutines may await events concurrently. On Windows,
+    // events are awaited with WaitForMultipleObjects, which is limited to 64
+    // handles.
+    bool schedule(detail::event_waiter_t& waiter, event_ref_t event);
+
+    // Steals a queued coroutine and runs it on the calling thread, returning
+    // false if none could be found. Threads that aren't workers of this
+    // scheduler only take coroutines scheduled without an affinity mask.
+    // Used by task_t::join to help drain the queues while waiting.
+    bool try_run_one();
+
+    topology_t const& topology() const noexcept
+    {
+        return topology_;
+    }
+
+    uint32_t worker_count() const noexcept
+    {
+        return worker_count_;
+    }
+
+    // The CPU the worker with the given ID is assigned to
+    uint32_t worker_cpu(uint32_t worker) const noexcept
+    {
+        return worker_cpus_[worker];
+    }
+
+    // The CPUs assigned to workers
+    cpu_mask_t const& cpu_mask() const noexcept
+    {
+        return cpu_mask_;
+    }
+
+    uint32_t priority_count() const noexcept
+    {
+        return priority_count_;
+    }
+
+#if defined(__linux__)
+    // The reactor awaiting file descriptors on behalf of this scheduler's
+    // coroutines
+    detail::reactor_t& reactor() noexcept
+    {
+        return reactor_;
+    }
+#endif
 
 private:
     friend class detail::work_queue_t;
 
+    // Attempts to claim a parked worker permitted by the affinity mask (other
+    // than the worker on CPU `exclude`), clearing its idle bit so that
+    // concurrent callers pick different workers. If a locality mask is
+    // supplied, only workers within it are considered. The claimed worker's
+    // index is written to `queue`.
+    bool claim_idle(cpu_mask_t const& cpu_affinity,
+                    uint32_t& queue,
+                    uint32_t exclude,
+                    cpu_mask_t const* locality = nullptr) noexcept;
+
+    // As above, but prefers workers sharing a last-level cache with CPU
+    // `origin`, followed by workers on the same NUMA node as `origin`. An origin of npos
+    // (e.g. if scheduling from a thread that isn't a worker) has no
+    // preference.
+    bool claim_nearby_idle(cpu_mask_t const& cpu_affinity,
+                           uint32_t& queue,
+                           uint32_t exclude,
+                           uint32_t origin) noexcept;
+
+    // Selects a worker when all permitted workers are busy, preferring
+    // workers on the same NUMA node as CPU `origin`
+    uint32_t select_busy(cpu_mask_t const& cpu_affinity,
+                         uint32_t origin) noexcept;
+
+    // Bits corresponding to CPUs without workers are cleared, and masks
+    // permitting every worker are emptied so that masks on machines with many
+    // CPUs aren't copied needlessly
+    void normalize(cpu_mask_t& cpu_affinity) const noexcept;
+
+    // Selects a worker permitted by the (normalized) affinity mask to enqueue
+    // a coroutine to, preferring idle workers near CPU `origin`
+    uint32_t select(cpu_mask_t const& cpu_affinity, uint32_t origin) noexcept;
+
+    // The CPU of the calling thread if it's one of our workers, or npos
+    uint32_t origin() const noexcept;
+
+    struct alignas(64) idle_word_t
+    {
+        std::atomic<uint64_t> bits{0};
+    };
+
     struct event_continuation_t
     {
-        std::coroutine_handle<> coroutine;
+        detail::event_waiter_t* waiter;
         event_ref_t event;
-        uint64_t cpu_affinity;
-        uint32_t priority;
     };
 
+#if defined(_WIN32)
     std::thread event_thread_;
     size_t event_count_    = 0;
     size_t event_capacity_ = 0;
@@ -85,20 +277,38 @@ private:
     size_t temp_storage_size_                  = 0;
     event_continuation_t* temp_storage_        = nullptr;
     moodycamel::ConcurrentQueue<event_continuation_t> pending_events_;
+#elif defined(__linux__)
+    // Awaits events (and the readiness of any other file descriptors)
+    detail::reactor_t reactor_;
+#endif
 
     std::atomic<bool> active_;
 
     // Allocated as an array. One queue is assigned to each CPU
     detail::work_queue_t* queues_ = nullptr;
 
+    // Bit i is set while the worker associated with queue i is parked. This
+    // lets the scheduler locate an idle worker without inspecting each queue.
+    // Each word of the bitmap occupies its own cache line.
+    idle_word_t* idle_         = nullptr;
+    uint32_t idle_word_count_ = 0;
+
     // Used to perform a low-discrepancy selection of work queue to enqueue a
-    // coroutine to
-    std::atomic<uint32_t> update_;
-
-    // Specifically, this is the number of concurrent threads possible, which
-    // may be double the physical CPU count if hyperthreading or similar
-    // technology is enabled
-    uint32_t cpu_count_;
-    uint32_t cpu_mask_;
+    // coroutine to when no permitted worker is idle
+    alignas(64) std::atomic<uint32_t> update_;
+
+    uint32_t worker_count_;
+
+    // The CPU assigned to each worker, and the worker assigned to each CPU
+    // (or npos). Idle bits and affinity masks are indexed by CPU.
+    uint32_t* worker_cpus_ = nullptr;
+    uint32_t* cpu_workers_ = nullptr;
+    uint32_t cpu_limit_    = 0;
+    cpu_mask_t cpu_mask_;
+
+    topology_t topology_;
+
+    uint32_t priority_count_     = 0;
+    uint32_t* priority_weights_ = nullptr;
 };
 } // namespace coop
\ No newline at end of file
@@ -0,0 +1,217 @@
+#pragma once
+
+#if defined(__linux__)
+
+#    include "cpu_mask.hpp"
+#    include "detail/api.hpp"
+#    include "detail/async_counter.hpp"
+#    include "detail/reactor.hpp"
+#    include "lazy_task.hpp"
+#    include "scheduler.hpp"
+#    include "source_location.hpp"
+#    include <cerrno>
+#    include <cstddef>
+#    include <cstdint>
+#    include <sys/epoll.h>
+#    include <sys/socket.h>
+#    include <sys/types.h>
+#    if defined(__clang__)
+#        include <experimental/coroutine>
+namespace std
+{
+using experimental::coroutine_handle;
+}
+#    else
+#        include <coroutine>
+#    endif
+
+namespace coop
+{
+namespace detail
+{
+    // A socket operation, attempted without blocking
+    struct COOP_API socket_op_t
+    {
+        enum class opcode_e : uint8_t
+        {
+            accept,
+            recv,
+            send,
+        };
+
+        opcode_e opcode = opcode_e::recv;
+        int socket      = -1;
+        void* buffer    = nullptr;
+        size_t size     = 0;
+
+        // Returns the accepted socket or the number of bytes transferred, or
+        // a negated errno value. Returns -EAGAIN if the socket isn't ready
+        // (or the call was interrupted).
+        ssize_t attempt() const noexcept;
+    };
+
+    // Suspends until the reactor reports the socket ready in the awaited
+    // direction, after which the coroutine is scheduled so the operation is
+    // retried on a worker rather than the reactor thread. Awaiting this
+    // produces 0, or an errno value if the socket can't be awaited.
+    template <Scheduler S>
+    class socket_awaiter_t : scheduled_waiter_t<S, reactor_waiter_t>
+    {
+    public:
+        socket_awaiter_t(int socket,
+                         uint32_t events,
+                         S& scheduler,
+                         cpu_mask_t cpu_mask,
+                         uint32_t priority,
+                         source_location_t source_location) noexcept
+            : scheduled_waiter_t<S, reactor_waiter_t>{scheduler,
+                                                      std::move(cpu_mask),
+                                                      priority,
+                                                      source_location}
+            , socket_{socket}
+            , events_{events}
+        {
+        }
+
+        socket_awaiter_t(socket_awaiter_t const&) = delete;
+        socket_awaiter_t& operator=(socket_awaiter_t const&) = delete;
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        bool await_suspend(std::coroutine_handle<> coroutine) noexcept
+        {
+            this->coroutine = coroutine;
+
+            // Custom schedulers without a reactor share the default
+            // scheduler's reactor
+            reactor_t* reactor;
+            if constexpr (requires { this->scheduler.reactor(); })
+            {
+                reactor = &this->scheduler.reactor();
+            }
+            else
+            {
+                reactor = &scheduler_t::instance().reactor();
+            }
+
+            // The coroutine may have already been scheduled by the reactor
+            // thread, so the awaiter must not be accessed on success
+            if (reactor->wait(socket_, events_, *this))
+            {
+                return true;
+            }
+            error_ = errno;
+            return false;
+        }
+
+        int await_resume() const noexcept
+        {
+            return error_;
+        }
+
+    private:
+        int socket_;
+        uint32_t events_;
+        int error_ = 0;
+    };
+
+    // Attempts the operation immediately, and only if the socket isn't ready
+    // waits for the reactor and tries again
+    template <Scheduler S>
+    lazy_task_t<ssize_t> socket_task(socket_op_t op,
+                                     S& scheduler,
+                                     cpu_mask_t cpu_mask,
+                                     uint32_t priority,
+                                     source_location_t source_location)
+    {
+        while (true)
+        {
+            ssize_t result = op.attempt();
+            if (result != -EAGAIN)
+            {
+                co_return result;
+            }
+
+            // Readiness may be spurious (e.g. another coroutine consumed the
+            // pending connection or data first), in which case wait again
+            int error = co_await socket_awaiter_t<S>{
+                op.socket,
+                op.opcode == socket_op_t::opcode_e::send ? EPOLLOUT : EPOLLIN,
+                scheduler,
+                cpu_mask,
+                priority,
+                source_location};
+            if (error != 0)
+            {
+                co_return -error;
+            }
+        }
+    }
+} // namespace detail
+
+// Accepts a connection on a non-blocking listening socket, suspending until
+// one is pending. Awaiting the returned value produces the accepted socket,
+// which is non-blocking and close-on-exec, or a negated errno value on
+// failure. After waiting, the coroutine is scheduled with the supplied
+// affinity and priority.
+template <Scheduler S = scheduler_t>
+inline auto accept(int listener,
+                   S& scheduler                             = S::instance(),
+                   cpu_mask_t cpu_mask                      = {},
+                   uint32_t priority                        = 0,
+                   source_location_t const& source_location = {})
+{
+    detail::socket_op_t op{detail::socket_op_t::opcode_e::accept,
+                           listener,
+                           nullptr,
+                           0};
+    return detail::socket_task(
+        op, scheduler, std::move(cpu_mask), priority, source_location);
+}
+
+// Receives up to `size` bytes from a connected socket, suspending until data
+// is available. Awaiting the returned value produces the number of bytes
+// received (0 once the peer has shut down), or a negated errno value on
+// failure. The socket need not be non-blocking.
+template <Scheduler S = scheduler_t>
+inline auto recv(int socket,
+                 void* buffer,
+                 size_t size,
+                 S& scheduler                             = S::instance(),
+                 cpu_mask_t cpu_mask                      = {},
+                 uint32_t priority                        = 0,
+                 source_location_t const& source_location = {})
+{
+    detail::socket_op_t op{detail::socket_op_t::opcode_e::recv,
+                           socket,
+                           buffer,
+                           size};
+    return detail::socket_task(
+        op, scheduler, std::move(cpu_mask), priority, source_location);
+}
+
+// Sends up to `size` bytes on a connected socket, suspending until there is
+// room in the send buffer. As with ::send, fewer bytes than requested may be
+// sent. A closed peer is reported as -EPIPE rather than by raising SIGPIPE.
+template <Scheduler S = scheduler_t>
+inline auto send(int socket,
+                 void const* buffer,
+                 size_t size,
+                 S& scheduler                             = S::instance(),
+                 cpu_mask_t cpu_mask                      = {},
+                 uint32_t priority                        = 0,
+                 source_location_t const& source_location = {})
+{
+    detail::socket_op_t op{detail::socket_op_t::opcode_e::send,
+                           socket,
+                           const_cast<void*>(buffer),
+                           size};
+    return detail::socket_task(
+        op, scheduler, std::move(cpu_mask), priority, source_location);
+}
+} // namespace coop
+
+#endif
@@ -0,0 +1,250 @@
+#pragma once
+
+#include "cpu_mask.hpp"
+#include "detail/api.hpp"
+#include "detail/async_counter.hpp"
+#include "scheduler.hpp"
+#include "source_location.hpp"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#if defined(__clang__)
+#    include <experimental/coroutine>
+namespace std
+{
+using experimental::coroutine_handle;
+}
+#else
+#    include <coroutine>
+#endif
+
+// Coroutine synchronization primitives. Waiting on any of them suspends the
+// coroutine rather than blocking its worker, and the waiting coroutine is
+// rescheduled with the scheduler, affinity, and priority it waited with once
+// it may proceed. Waiters are stored in the awaiters of the waiting
+// coroutines, so none of these allocate.
+
+namespace coop
+{
+namespace detail
+{
+    // Suspends the coroutine until it's handed a unit of the counter
+    template <Scheduler S>
+    class counter_awaiter_t : scheduled_waiter_t<S>
+    {
+    public:
+        counter_awaiter_t(async_counter_t& counter,
+                          S& scheduler,
+                          cpu_mask_t cpu_mask,
+                          uint32_t priority,
+                          source_location_t source_location) noexcept
+            : scheduled_waiter_t<S>{scheduler, std::move(cpu_mask), priority, source_location}
+            , counter_{counter}
+        {
+        }
+
+        counter_awaiter_t(counter_awaiter_t const&) = delete;
+        counter_awaiter_t& operator=(counter_awaiter_t const&) = delete;
+
+        bool await_ready() noexcept
+        {
+            return counter_.try_acquire();
+        }
+
+        bool await_suspend(std::coroutine_handle<> coroutine) noexcept
+        {
+            this->coroutine = coroutine;
+            return counter_.acquire_or_wait(*this);
+        }
+
+        void await_resume() const noexcept
+        {
+        }
+
+    private:
+        async_counter_t& counter_;
+    };
+
+    // Suspends the coroutine via a function returning whether it must wait
+    // (given the waiter to queue)
+    template <Scheduler S, typename Primitive, bool (Primitive::*Wait)(waiter_t&) noexcept>
+    class primitive_awaiter_t : scheduled_waiter_t<S>
+    {
+    public:
+        primitive_awaiter_t(Primitive& primitive,
+                            bool ready,
+                            S& scheduler,
+                            cpu_mask_t cpu_mask,
+                            uint32_t priority,
+                            source_location_t source_location) noexcept
+            : scheduled_waiter_t<S>{scheduler, std::move(cpu_mask), priority, source_location}
+            , primitive_{primitive}
+            , ready_{ready}
+        {
+        }
+
+        primitive_awaiter_t(primitive_awaiter_t const&) = delete;
+        primitive_awaiter_t& operator=(primitive_awaiter_t const&) = delete;
+
+        bool await_ready() const noexcept
+        {
+            return ready_;
+        }
+
+        bool await_suspend(std::coroutine_handle<> coroutine) noexcept
+        {
+            this->coroutine = coroutine;
+            return (primitive_.*Wait)(*this);
+        }
+
+        void await_resume() const noexcept
+        {
+        }
+
+    private:
+        Primitive& primitive_;
+        bool ready_;
+    };
+} // namespace detail
+
+// A counting semaphore, e.g. to limit the number of coroutines performing
+// some operation at once:
+//
+//     coop::async_semaphore_t reads{16};
+//
+//     co_await reads.acquire();
+//     co_await coop::read(fd, buffer, size, offset);
+//     reads.release();
+//
+// Acquiring while units are available is a single compare-and-swap, and
+// waiters are handed released units in the order they arrived.
+class async_semaphore_t
+{
+public:
+    explicit async_semaphore_t(int64_t count) noexcept
+        : counter_{count}
+    {
+    }
+    async_semaphore_t(async_semaphore_t const&) = delete;
+    async_semaphore_t& operator=(async_semaphore_t const&) = delete;
+
+    // Acquires a unit, suspending until one is available. Remember to
+    // `co_await` this function's returned value.
+    template <Scheduler S = scheduler_t>
+    detail::counter_awaiter_t<S>
+    acquire(S& scheduler                             = S::instance(),
+            cpu_mask_t cpu_mask                      = {},
+            uint32_t priority                        = 0,
+            source_location_t const& source_location = {}) noexcept
+    {
+        return {counter_, scheduler, std::move(cpu_mask), priority, source_location};
+    }
+
+    bool try_acquire() noexcept
+    {
+        return counter_.try_acquire();
+    }
+
+    // May be called from any thread
+    void release(int64_t count = 1) noexcept
+    {
+        counter_.release(count);
+    }
+
+    // The number of available units (approximate while in use)
+    int64_t count() const noexcept
+    {
+        return counter_.count();
+    }
+
+private:
+    detail::async_counter_t counter_;
+};
+
+// A single-use countdown, e.g. for a coroutine to wait until a set of
+// operations it fanned out has completed. Once the count reaches zero, every
+// waiting coroutine is resumed and all future waits complete immediately.
+class COOP_API async_latch_t
+{
+public:
+    explicit async_latch_t(int64_t count) noexcept
+        : count_{count}
+        , waiters_{count > 0 ? uintptr_t(0) : released}
+    {
+    }
+    async_latch_t(async_latch_t const&) = delete;
+    async_latch_t& operator=(async_latch_t const&) = delete;
+
+    // May be called from any thread
+    void count_down(int64_t count = 1) noexcept;
+
+    bool try_wait() const noexcept
+    {
+        return count_.load(std::memory_order_acquire) <= 0;
+    }
+
+    // Suspends until the count reaches zero. Remember to `co_await` this
+    // function's returned value.
+    template <Scheduler S = scheduler_t>
+    auto wait(S& scheduler                             = S::instance(),
+              cpu_mask_t cpu_mask                      = {},
+              uint32_t priority                        = 0,
+              source_location_t const& source_location = {}) noexcept
+    {
+        return detail::primitive_awaiter_t<S, async_latch_t, &async_latch_t::wait_or_release>{
+            *this, try_wait(), scheduler, std::move(cpu_mask), priority, source_location};
+    }
+
+private:
+    constexpr static uintptr_t released = 1;
+
+    // Queues the waiter and returns true, or returns false if the latch has
+    // already been released
+    bool wait_or_release(detail::waiter_t& waiter) noexcept;
+
+    std::atomic<int64_t> count_;
+
+    // A lock-free stack of waiters, or `released` once the count reaches zero
+    std::atomic<uintptr_t> waiters_;
+};
+
+// A reusable barrier for a fixed number of participating coroutines, e.g. to
+// synchronize the phases of a simulation step. Each phase completes once every
+// participant has arrived, at which point they're all resumed and the barrier
+// resets for the next phase.
+class COOP_API async_barrier_t
+{
+public:
+    explicit async_barrier_t(uint32_t count) noexcept
+        : count_{count}
+        , remaining_{count}
+    {
+    }
+    async_barrier_t(async_barrier_t const&) = delete;
+    async_barrier_t& operator=(async_barrier_t const&) = delete;
+
+    // Arrives at the barrier and suspends until the current phase completes.
+    // The last participant to arrive continues without suspending. Remember
+    // to `co_await` this function's returned value.
+    template <Scheduler S = scheduler_t>
+    auto arrive_and_wait(S& scheduler                             = S::instance(),
+                         cpu_mask_t cpu_mask                      = {},
+                         uint32_t priority                        = 0,
+                         source_location_t const& source_location = {}) noexcept
+    {
+        return detail::primitive_awaiter_t<S, async_barrier_t, &async_barrier_t::arrive_or_wait>{
+            *this, false, scheduler, std::move(cpu_mask), priority, source_location};
+    }
+
+private:
+    // Queues the waiter and returns true, or completes the phase and returns
+    // false if the waiter is the last to arrive
+    bool arrive_or_wait(detail::waiter_t& waiter) noexcept;
+
+    std::mutex mutex_;
+    uint32_t count_;
+    uint32_t remaining_;
+    detail::waiter_t* waiters_ = nullptr;
+};
+} // namespace coop
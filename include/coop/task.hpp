@@ -1,5 +1,7 @@
 #pragma once
 
+#include "cpu_mask.hpp"
+#include "deadline.hpp"
 #include "detail/api.hpp"
 #include "detail/promise.hpp"
 #include "detail/tracer.hpp"
@@ -8,6 +10,7 @@
 #include <cstdlib>
 #include <functional>
 #include <limits>
+#include <utility>
 #if defined(__clang__)
 #    include <experimental/coroutine>
 namespace std
@@ -22,6 +25,11 @@ using experimental::suspend_never;
 
 namespace coop
 {
+namespace detail
+{
+    struct task_access_t;
+}
+
 template <typename T = void, bool Joinable = false>
 class task_t
 {
@@ -44,15 +52,7 @@ public:
     {
         if (this != &other)
         {
-            // For joinable tasks, the coroutine is destroyed in the final
-            // awaiter to support fire-and-forget semantics
-            if constexpr (!Joinable)
-            {
-                if (coroutine_)
-                {
-                    coroutine_.destroy();
-                }
-            }
+            release();
             coroutine_       = other.coroutine_;
             other.coroutine_ = nullptr;
         }
@@ -60,13 +60,7 @@ public:
     }
     ~task_t() noexcept
     {
-        if constexpr (!Joinable)
-        {
-            if (coroutine_)
-            {
-                coroutine_.destroy();
-            }
-        }
+        release();
     }
 
     // The dereferencing operators below return the data contained in the
@@ -94,16 +88,85 @@ public:
 
     [[nodiscard]] bool await_ready() const noexcept
     {
-        return !coroutine_ || coroutine_.done();
+        if constexpr (Joinable)
+        {
+            // The joinable coroutine may complete on another thread
+            return !coroutine_
+                   || (promise().join_state.load(std::memory_order_acquire)
+                       & promise_type::join_completed);
+        }
+        else
+        {
+            return !coroutine_
+                   || promise().waiter.load(std::memory_order_acquire)
+                          == promise_type::waiter_done;
+        }
     }
 
+    // Blocks until the coroutine completes. Short tasks are waited on by
+    // spinning briefly, after which the thread parks on the task's join word
+    // (a futex on Linux). The coroutine drops its reference to the frame as
+    // it completes, so once this returns, the worker no longer touches the
+    // frame, and it's destroyed along with this task (e.g. resources used by
+    // the frame's allocator, such as an arena, may be torn down afterwards).
     void join()
     {
         static_assert(Joinable,
                       "Cannot join a task without the Joinable type "
                       "parameter "
                       "set");
-        coroutine_.promise().join_sem.acquire();
+        auto& state = promise().join_state;
+        for (int i = 0; i != 64; ++i)
+        {
+            if (state.load(std::memory_order_acquire) & promise_type::join_completed)
+            {
+                return;
+            }
+            if (i >= 32)
+            {
+                std::this_thread::yield();
+            }
+        }
+
+        uint32_t value
+            = state.fetch_or(promise_type::join_waiting, std::memory_order_acquire)
+              | promise_type::join_waiting;
+        while (!(value & promise_type::join_completed))
+        {
+            state.wait(value, std::memory_order_acquire);
+            value = state.load(std::memory_order_acquire);
+        }
+    }
+
+    // As above, but the calling thread runs coroutines queued on `scheduler`
+    // (see scheduler_t::try_run_one) while the task is outstanding, so that a
+    // thread joining a task tree contributes to it instead of idling. Once the
+    // queues stay empty, the thread parks as in a plain join.
+    template <typename S>
+    void join(S& scheduler)
+    {
+        static_assert(Joinable,
+                      "Cannot join a task without the Joinable type "
+                      "parameter "
+                      "set");
+        auto& state = promise().join_state;
+        int misses  = 0;
+        while (!(state.load(std::memory_order_acquire) & promise_type::join_completed))
+        {
+            if (scheduler.try_run_one())
+            {
+                misses = 0;
+            }
+            else if (++misses == 64)
+            {
+                join();
+                return;
+            }
+            else if (misses >= 32)
+            {
+                std::this_thread::yield();
+            }
+        }
     }
 
     // When suspending from a coroutine *within* this task's coroutine, save
@@ -128,11 +191,30 @@ public:
     }
 
 protected:
+    friend struct detail::task_access_t;
+
     [[nodiscard]] promise_type& promise() const noexcept
     {
         return coroutine_.promise();
     }
 
+    void release() noexcept
+    {
+        if (coroutine_)
+        {
+            if constexpr (Joinable)
+            {
+                // A detached joinable task runs to completion, which releases
+                // the frame if this was the last reference
+                promise().release(coroutine_);
+            }
+            else
+            {
+                coroutine_.destroy();
+            }
+        }
+    }
+
     std::coroutine_handle<promise_type> coroutine_ = nullptr;
 };
 
@@ -142,20 +224,21 @@ protected:
 //
 // The least significant bit of the CPU mask, corresponds to CPU 0. A non-zero
 // mask will prevent this coroutine from being scheduled on CPUs corresponding
-// to bits that are set
+// to bits that are not set. Plain 64-bit integers convert implicitly to masks,
+// and cpu_mask_t::set can be used to address CPUs beyond the first 64.
 //
 // Threadsafe only if scheduler_t::schedule is threadsafe (the default one
 // provided is threadsafe).
 template <Scheduler S = scheduler_t>
 inline auto suspend(S& scheduler                             = S::instance(),
-                    uint64_t cpu_mask                        = 0,
+                    cpu_mask_t cpu_mask                      = {},
                     uint32_t priority                        = 0,
                     source_location_t const& source_location = {}) noexcept
 {
     struct awaiter_t
     {
-        scheduler_t& scheduler;
-        uint64_t cpu_mask;
+        S& scheduler;
+        cpu_mask_t cpu_mask;
         uint32_t priority;
         source_location_t source_location;
 
@@ -174,7 +257,55 @@ inline auto suspend(S& scheduler                             = S::instance(),
         }
     };
 
-    return awaiter_t{scheduler, cpu_mask, priority, source_location};
+    return awaiter_t{scheduler, std::move(cpu_mask), priority, source_location};
+}
+
+// Suspend the current coroutine to be run in earliest-deadline-first order
+// with other coroutines scheduled with deadlines (ahead of coroutines
+// scheduled by priority). The CPU mask is interpreted as above.
+//
+// Schedulers that don't implement the optional deadline overload of
+// `schedule` (see scheduler_t) schedule the coroutine with priority 0.
+template <Scheduler S = scheduler_t>
+inline auto suspend(S& scheduler,
+                    deadline_t deadline,
+                    cpu_mask_t cpu_mask                      = {},
+                    source_location_t const& source_location = {}) noexcept
+{
+    struct awaiter_t
+    {
+        S& scheduler;
+        deadline_t deadline;
+        cpu_mask_t cpu_mask;
+        source_location_t source_location;
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        void await_resume() const noexcept
+        {
+        }
+
+        void await_suspend(std::coroutine_handle<> coroutine) const noexcept
+        {
+            if constexpr (requires {
+                              scheduler.schedule(
+                                  coroutine, deadline, cpu_mask, source_location);
+                          })
+            {
+                scheduler.schedule(
+                    coroutine, deadline, cpu_mask, source_location);
+            }
+            else
+            {
+                scheduler.schedule(coroutine, cpu_mask, 0, source_location);
+            }
+        }
+    };
+
+    return awaiter_t{scheduler, deadline, std::move(cpu_mask), source_location};
 }
 
 #define COOP_SUSPEND()        \
@@ -200,4 +331,7 @@ inline auto suspend(S& scheduler                             = S::instance(),
                              cpu_mask,                        \
                              priority,                        \
                              {__FILE__, __LINE__})
+
+#define COOP_SUSPEND_DEADLINE(scheduler, deadline) \
+    co_await ::coop::suspend(scheduler, deadline, 0, {__FILE__, __LINE__})
 } // namespace coop
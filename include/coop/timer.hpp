@@ -0,0 +1,234 @@
+#pragma once
+
+#include "cpu_mask.hpp"
+#include "deadline.hpp"
+#include "detail/api.hpp"
+#include "scheduler.hpp"
+#include "source_location.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#if defined(__clang__)
+#    include <experimental/coroutine>
+namespace std
+{
+using experimental::coroutine_handle;
+}
+#else
+#    include <coroutine>
+#endif
+
+namespace coop
+{
+class timer_service_t;
+
+namespace detail
+{
+    // Intrusive list node for a pending timer. Timer nodes are owned by the
+    // caller (typically embedded in an awaiter within a suspended coroutine
+    // frame), so adding and cancelling timers never allocates.
+    struct timer_node_t
+    {
+        // Invoked on the timer thread once the timer expires. The node is no
+        // longer referenced by the timer service when this is called, so it may
+        // be destroyed by the callback (e.g. by resuming its coroutine).
+        void (*expire)(timer_node_t* node) = nullptr;
+
+        // Managed by the timer service
+        timer_node_t* next   = nullptr;
+        timer_node_t* prev   = nullptr;
+        timer_node_t** slot  = nullptr;
+        uint64_t expiry_tick = 0;
+    };
+} // namespace detail
+
+// Expires timers using a hierarchical timing wheel (in the style of Varghese
+// and Lauck) driven by a dedicated thread. The wheel has four levels of 64
+// slots. Each slot of level L spans 64^L ticks, so timers up to 64^4 ticks
+// away (about 4.6 hours at the default 1 ms tick) are placed directly, and
+// later timers are parked in the outermost level until they come into range.
+// Adding and cancelling a timer are O(1) regardless of how many timers are
+// pending. Each timer is moved at most once per level as it approaches
+// expiry. The thread sleeps until the next tick with an occupied slot (to
+// expire or cascade) rather than waking every tick, and is woken early when a
+// timer is added that expires sooner.
+//
+// Timers never expire early, but may expire up to one tick late (plus
+// however long the timer thread takes to be scheduled by the OS).
+class COOP_API timer_service_t
+{
+public:
+    // Returns the timer service used by coop::sleep_for and coop::sleep_until
+    static timer_service_t& instance() noexcept;
+
+    explicit timer_service_t(
+        std::chrono::nanoseconds tick = std::chrono::milliseconds{1});
+    ~timer_service_t() noexcept;
+    timer_service_t(timer_service_t const&) = delete;
+    timer_service_t(timer_service_t&&)      = delete;
+    timer_service_t& operator=(timer_service_t const&) = delete;
+    timer_service_t& operator=(timer_service_t&&) = delete;
+
+    // Arms a timer which expires at the supplied deadline. The node must
+    // remain valid until it expires or is cancelled.
+    void add(detail::timer_node_t* node, deadline_t deadline);
+
+    // Disarms a timer, returning false if it isn't pending (e.g. because it
+    // already expired). If the timer's callback is running on the timer
+    // thread, waits for it to return, so that the node may be destroyed once
+    // this returns.
+    bool cancel(detail::timer_node_t* node) noexcept;
+
+    // The number of timers pending
+    size_t size() const noexcept;
+
+private:
+    constexpr static uint32_t level_count = 4;
+    constexpr static uint32_t slot_bits   = 6;
+    constexpr static uint32_t slot_count  = 1 << slot_bits;
+
+    // Places a node in the slot corresponding to its expiry relative to the
+    // current tick (requires the lock)
+    void place(detail::timer_node_t* node) noexcept;
+
+    void unlink(detail::timer_node_t* node) noexcept;
+
+    // Advances the wheel by a single tick, moving expired nodes to
+    // `expired_` (requires the lock)
+    void advance() noexcept;
+
+    // Returns the first tick after the current one at which an occupied slot
+    // is processed, or UINT64_MAX if no timers are pending (requires the
+    // lock)
+    uint64_t next_tick() const noexcept;
+
+    std::thread thread_;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    bool active_ = true;
+
+    // Signaled whenever a callback returns, for cancel
+    std::condition_variable expiry_cv_;
+
+    deadline_t epoch_;
+    std::chrono::nanoseconds tick_;
+
+    // The last tick processed
+    uint64_t now_  = 0;
+    size_t size_   = 0;
+
+    // The tick the thread is sleeping until
+    uint64_t wake_tick_ = UINT64_MAX;
+
+    detail::timer_node_t* slots_[level_count][slot_count] = {};
+
+    // Expired timers whose callbacks haven't run yet, and the timer whose
+    // callback is running
+    detail::timer_node_t* expired_ = nullptr;
+    detail::timer_node_t* running_ = nullptr;
+};
+
+namespace detail
+{
+    template <Scheduler S>
+    class sleep_awaiter_t : timer_node_t
+    {
+    public:
+        sleep_awaiter_t(deadline_t deadline,
+                        S& scheduler,
+                        cpu_mask_t cpu_mask,
+                        uint32_t priority,
+                        source_location_t source_location) noexcept
+            : deadline_{deadline}
+            , scheduler_{scheduler}
+            , cpu_mask_{std::move(cpu_mask)}
+            , priority_{priority}
+            , source_location_{source_location}
+        {
+            expire = [](timer_node_t* node) {
+                auto& self = *static_cast<sleep_awaiter_t*>(node);
+                self.scheduler_.schedule(self.coroutine_,
+                                         self.cpu_mask_,
+                                         self.priority_,
+                                         self.source_location_);
+            };
+        }
+
+        sleep_awaiter_t(sleep_awaiter_t const&) = delete;
+        sleep_awaiter_t& operator=(sleep_awaiter_t const&) = delete;
+
+        // If the suspended coroutine is destroyed before the timer expires,
+        // the timer is cancelled
+        ~sleep_awaiter_t() noexcept
+        {
+            // Whether the timer is still pending is only known under the
+            // service's lock, and if its callback is still running on the
+            // timer thread (having just scheduled the coroutine), cancel
+            // waits for it to return before the node is destroyed
+            if (armed_)
+            {
+                timer_service_t::instance().cancel(this);
+            }
+        }
+
+        bool await_ready() const noexcept
+        {
+            return deadline_ <= std::chrono::steady_clock::now();
+        }
+
+        void await_suspend(std::coroutine_handle<> coroutine)
+        {
+            coroutine_ = coroutine;
+            armed_     = true;
+            timer_service_t::instance().add(this, deadline_);
+        }
+
+        void await_resume() const noexcept
+        {
+        }
+
+    private:
+        deadline_t deadline_;
+        S& scheduler_;
+        cpu_mask_t cpu_mask_;
+        uint32_t priority_;
+        source_location_t source_location_;
+        std::coroutine_handle<> coroutine_;
+        bool armed_ = false;
+    };
+} // namespace detail
+
+// Suspends the current coroutine until the deadline passes, after which it's
+// scheduled with the supplied affinity and priority. Unlike
+// std::this_thread::sleep_for, this doesn't occupy a worker while waiting.
+// Remember to `co_await` this function's returned value.
+template <Scheduler S = scheduler_t>
+inline auto sleep_until(deadline_t deadline,
+                        S& scheduler                             = S::instance(),
+                        cpu_mask_t cpu_mask                      = {},
+                        uint32_t priority                        = 0,
+                        source_location_t const& source_location = {}) noexcept
+{
+    return detail::sleep_awaiter_t<S>{
+        deadline, scheduler, std::move(cpu_mask), priority, source_location};
+}
+
+template <Scheduler S = scheduler_t, typename Rep, typename Period>
+inline auto sleep_for(std::chrono::duration<Rep, Period> duration,
+                      S& scheduler                             = S::instance(),
+                      cpu_mask_t cpu_mask                      = {},
+                      uint32_t priority                        = 0,
+                      source_location_t const& source_location = {}) noexcept
+{
+    return detail::sleep_awaiter_t<S>{
+        std::chrono::steady_clock::now()
+            + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                duration),
+        scheduler,
+        std::move(cpu_mask),
+        priority,
+        source_location};
+}
+} // namespace coop
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "cpu_mask.hpp"
+#include "detail/api.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace coop
+{
+// Describes how the CPUs of a machine relate to one another in terms of
+// memory and cache locality. The scheduler uses this to prefer placing and
+// stealing coroutines close to where they were spawned, since migrating a
+// coroutine frame across a last-level cache or socket boundary is costly.
+class COOP_API topology_t
+{
+public:
+    // Relative cost of moving work between two CPUs, from cheapest to most
+    // expensive
+    enum class distance_e : uint32_t
+    {
+        // The CPUs are SMT siblings of the same physical core
+        core,
+        // The CPUs share a last-level cache (e.g. an L3 slice or CCX)
+        cache,
+        // The CPUs are attached to the same NUMA node
+        node,
+        remote
+    };
+
+    // Discovers the topology of the CPUs [0, cpu_count). On Linux, this reads
+    // NUMA nodes, last-level cache domains and SMT siblings from sysfs. On
+    // other platforms, or if sysfs is unavailable, every CPU is treated as a
+    // distinct core sharing one cache and node.
+    static topology_t discover(uint32_t cpu_count);
+
+    // Returns the CPUs the calling thread may run on. On Linux, this is the
+    // thread's affinity mask, which reflects any cpuset the process is
+    // confined to (e.g. by taskset or a container runtime). On Windows, this
+    // is the process affinity mask, which only covers the process's primary
+    // processor group. Elsewhere, or if the mask can't be queried, all
+    // std::thread::hardware_concurrency() CPUs are returned.
+    static cpu_mask_t available_cpus();
+
+    // Returns the number of CPUs worth of time the process may consume (rounded
+    // up) according to the cgroup v2 `cpu.max` bandwidth limits of its cgroup
+    // and its ancestors, or 0 if no limit applies or the limits can't be read.
+    static uint32_t cpu_quota();
+
+    // Returns the number of CPUs worth of time (rounded up, and at least one)
+    // permitted by the contents of a cgroup v2 `cpu.max` file, i.e.
+    // "<quota> <period>", or 0 if the quota is "max" or the line is malformed
+    static uint32_t parse_cpu_max(char const* line);
+
+    uint32_t cpu_count() const noexcept
+    {
+        return static_cast<uint32_t>(cpus_.size());
+    }
+
+    uint32_t node_count() const noexcept
+    {
+        return node_count_;
+    }
+
+    // The NUMA node the CPU is attached to
+    uint32_t node(uint32_t cpu) const noexcept
+    {
+        return cpus_[cpu].node;
+    }
+
+    // The CPUs sharing a last-level cache with the given CPU (including
+    // itself)
+    cpu_mask_t const& cache_mask(uint32_t cpu) const noexcept
+    {
+        return cpus_[cpu].cache_mask;
+    }
+
+    // The CPUs attached to the same NUMA node as the given CPU (including
+    // itself)
+    cpu_mask_t const& node_mask(uint32_t cpu) const noexcept
+    {
+        return cpus_[cpu].node_mask;
+    }
+
+    distance_e distance(uint32_t a, uint32_t b) const noexcept
+    {
+        cpu_info_t const& lhs = cpus_[a];
+        cpu_info_t const& rhs = cpus_[b];
+        if (lhs.core == rhs.core)
+        {
+            return distance_e::core;
+        }
+        else if (lhs.cache == rhs.cache)
+        {
+            return distance_e::cache;
+        }
+        else if (lhs.node == rhs.node)
+        {
+            return distance_e::node;
+        }
+        return distance_e::remote;
+    }
+
+private:
+    struct cpu_info_t
+    {
+        // Cores and caches are identified by the lowest CPU sharing them
+        uint32_t core  = 0;
+        uint32_t cache = 0;
+        uint32_t node  = 0;
+        cpu_mask_t cache_mask;
+        cpu_mask_t node_mask;
+    };
+
+    std::vector<cpu_info_t> cpus_;
+    uint32_t node_count_ = 1;
+};
+} // namespace coop
@@ -0,0 +1,219 @@
+#pragma once
+
+#include "detail/promise.hpp"
+#include "task.hpp"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#if defined(__clang__)
+#    include <experimental/coroutine>
+namespace std
+{
+using experimental::coroutine_handle;
+}
+#else
+#    include <coroutine>
+#endif
+
+namespace coop
+{
+namespace detail
+{
+    struct task_access_t
+    {
+        template <typename T>
+        static promise_base_t<false>& promise(task_t<T, false>& task) noexcept
+        {
+            return task.promise();
+        }
+
+        static promise_base_t<false>& promise(promise_base_t<false>* promise) noexcept
+        {
+            return *promise;
+        }
+    };
+
+    // Awaits a group of tasks (held as an array of promises, or a reference to
+    // a range of tasks) by registering a single shared state with all of them,
+    // so that the awaiting coroutine is resumed once, by whichever task
+    // releases the last count
+    template <typename Tasks, bool Any>
+    class when_awaiter_t : public when_state_t
+    {
+    public:
+        explicit when_awaiter_t(Tasks tasks) noexcept
+            : tasks_{tasks}
+        {
+            if constexpr (Any)
+            {
+                withdraw = &withdraw_all;
+            }
+        }
+
+        bool await_ready() noexcept
+        {
+            for (auto&& task : tasks_)
+            {
+                promise_base_t<false>& promise = task_access_t::promise(task);
+                bool done = promise.waiter.load(std::memory_order_acquire)
+                            == promise.waiter_done;
+                if constexpr (Any)
+                {
+                    if (done)
+                    {
+                        first.store(&promise, std::memory_order_relaxed);
+                        return true;
+                    }
+                }
+                else if (!done)
+                {
+                    return false;
+                }
+            }
+
+            // when_any only completes immediately if there's nothing to await
+            return !Any || std::size(tasks_) == 0;
+        }
+
+        bool await_suspend(std::coroutine_handle<> coroutine) noexcept
+        {
+            parent = coroutine;
+
+            // The extra count held while registering prevents the parent from
+            // being resumed before we're done
+            size_t released = 1;
+            count.store(std::size(tasks_) + 1, std::memory_order_relaxed);
+            auto self = reinterpret_cast<uintptr_t>(static_cast<when_state_t*>(this));
+            for (auto&& task : tasks_)
+            {
+                promise_base_t<false>& promise = task_access_t::promise(task);
+                if (Any && first.load(std::memory_order_acquire))
+                {
+                    ++released;
+                    continue;
+                }
+
+                uintptr_t waiter = promise.waiter_idle;
+                if (!promise.waiter.compare_exchange_strong(waiter,
+                                                            self,
+                                                            std::memory_order_release,
+                                                            std::memory_order_acquire))
+                {
+                    // The task already completed
+                    ++released;
+                    if constexpr (Any)
+                    {
+                        void* expected = nullptr;
+                        first.compare_exchange_strong(
+                            expected, &promise, std::memory_order_acq_rel);
+                    }
+                }
+            }
+
+            if (Any && first.load(std::memory_order_acquire))
+            {
+                withdraw_all(*this);
+            }
+
+            // Resume immediately if every task already released its count
+            return count.fetch_sub(released, std::memory_order_acq_rel) != released;
+        }
+
+        // when_any returns the index of the first task to complete (or the
+        // number of tasks if there are none)
+        auto await_resume() const noexcept
+        {
+            if constexpr (Any)
+            {
+                void* promise = first.load(std::memory_order_acquire);
+                size_t index  = 0;
+                for (auto&& task : tasks_)
+                {
+                    if (&task_access_t::promise(task) == promise)
+                    {
+                        break;
+                    }
+                    ++index;
+                }
+                return index;
+            }
+        }
+
+    private:
+        // Takes back the registrations of tasks that haven't completed, so
+        // that they can be awaited again later
+        static void withdraw_all(when_state_t& state) noexcept
+        {
+            auto& self = static_cast<when_awaiter_t&>(state);
+            auto registered
+                = reinterpret_cast<uintptr_t>(static_cast<when_state_t*>(&self));
+            for (auto&& task : self.tasks_)
+            {
+                uintptr_t waiter = registered;
+                if (task_access_t::promise(task).waiter.compare_exchange_strong(
+                        waiter,
+                        promise_base_t<false>::waiter_idle,
+                        std::memory_order_acq_rel))
+                {
+                    // Our caller holds a count, so this is never the last
+                    self.count.fetch_sub(1, std::memory_order_relaxed);
+                }
+            }
+        }
+
+        Tasks tasks_;
+    };
+
+    template <typename... T>
+    using when_promises_t = std::array<promise_base_t<false>*, sizeof...(T)>;
+} // namespace detail
+
+// Suspends the current coroutine until every task completes, resuming it
+// exactly once. Remember to `co_await` this function's returned value:
+//
+//     auto a = load_mesh();
+//     auto b = load_texture();
+//     co_await coop::when_all(a, b);
+//
+// The results remain in the tasks, and may be retrieved by dereferencing or
+// awaiting them (which completes immediately).
+template <typename... T>
+inline auto when_all(task_t<T>&... tasks) noexcept
+{
+    return detail::when_awaiter_t<detail::when_promises_t<T...>, false>{
+        {&detail::task_access_t::promise(tasks)...}};
+}
+
+// As above, for a range of tasks (e.g. a std::vector<task_t<T>>)
+template <typename Range>
+requires requires(Range& tasks)
+{
+    std::begin(tasks);
+}
+inline auto when_all(Range& tasks) noexcept
+{
+    return detail::when_awaiter_t<Range&, false>{tasks};
+}
+
+// Suspends the current coroutine until any one of the tasks completes,
+// resuming it with the index of that task. The remaining tasks keep running
+// and must still be awaited (e.g. with when_all) before they are destroyed.
+template <typename... T>
+inline auto when_any(task_t<T>&... tasks) noexcept
+{
+    return detail::when_awaiter_t<detail::when_promises_t<T...>, true>{
+        {&detail::task_access_t::promise(tasks)...}};
+}
+
+template <typename Range>
+requires requires(Range& tasks)
+{
+    std::begin(tasks);
+}
+inline auto when_any(Range& tasks) noexcept
+{
+    return detail::when_awaiter_t<Range&, true>{tasks};
+}
+} // namespace coop
@@ -0,0 +1,100 @@
+#include <coop/arena.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <new>
+#include <thread>
+
+using namespace coop;
+
+arena_t::arena_t(size_t block_size)
+    : block_size_{std::max(block_size, size_t{1024})}
+{
+    current_ = create_block(block_size_);
+}
+
+arena_t::~arena_t() noexcept
+{
+    assert(frames_.load(std::memory_order_relaxed) == 0
+           && "Arena destroyed with live frames");
+
+    block_t* block = current_.load(std::memory_order_relaxed);
+    while (block)
+    {
+        block_t* next = block->next;
+        block->~block_t();
+        ::operator delete(block);
+        block = next;
+    }
+}
+
+void arena_t::reset() noexcept
+{
+    // Blocks are linked from newest to oldest, so the first block is last
+    block_t* block = current_.load(std::memory_order_relaxed);
+    while (block->next)
+    {
+        block_t* next = block->next;
+        block->~block_t();
+        ::operator delete(block);
+        block = next;
+    }
+
+    block->offset.store(0, std::memory_order_relaxed);
+    current_.store(block, std::memory_order_release);
+    allocated_.store(0, std::memory_order_relaxed);
+}
+
+void arena_t::release() noexcept
+{
+    // Frames allocated after the count reached zero start a new tree, which
+    // must not have its memory reset underneath it. Those allocated while the
+    // release is underway wait for it to finish.
+    uint64_t expected = 0;
+    if (!frames_.compare_exchange_strong(
+            expected, releasing, std::memory_order_acq_rel, std::memory_order_relaxed))
+    {
+        return;
+    }
+
+    reset();
+    frames_.fetch_sub(releasing, std::memory_order_release);
+}
+
+void arena_t::wait_for_release() const noexcept
+{
+    while (frames_.load(std::memory_order_acquire) & releasing)
+    {
+        std::this_thread::yield();
+    }
+}
+
+arena_t::block_t* arena_t::create_block(size_t capacity)
+{
+    void* raw = ::operator new(sizeof(block_t) + capacity);
+    auto* out = new (raw) block_t{};
+    out->capacity = capacity;
+    return out;
+}
+
+void* arena_t::allocate_slow(size_t size)
+{
+    std::lock_guard lock{mutex_};
+
+    while (true)
+    {
+        // Another thread may have already installed a new block
+        block_t* block = current_.load(std::memory_order_acquire);
+        size_t offset  = block->offset.fetch_add(size, std::memory_order_relaxed);
+        if (offset + size <= block->capacity)
+        {
+            allocated_.fetch_add(size, std::memory_order_relaxed);
+            return block->data() + offset;
+        }
+
+        // The remainder of the exhausted block is abandoned
+        block_t* next = create_block(std::max(block_size_, size));
+        next->next    = block;
+        current_.store(next, std::memory_order_release);
+    }
+}
@@ -0,0 +1,67 @@
+#include <coop/detail/async_counter.hpp>
+
+using namespace coop::detail;
+
+bool async_counter_t::acquire_or_wait(waiter_t& waiter) noexcept
+{
+    std::lock_guard lock{mutex_};
+
+    // Announce ourselves before checking the count one last time. A release
+    // that we miss here is guaranteed to see us and take the lock.
+    waiting_.fetch_add(1);
+    if (try_acquire())
+    {
+        waiting_.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    waiter.next = nullptr;
+    if (tail_)
+    {
+        tail_->next = &waiter;
+    }
+    else
+    {
+        head_ = &waiter;
+    }
+    tail_ = &waiter;
+    return true;
+}
+
+void async_counter_t::wake() noexcept
+{
+    waiter_t* woken = nullptr;
+    waiter_t* last  = nullptr;
+    {
+        std::lock_guard lock{mutex_};
+        while (head_ && try_acquire())
+        {
+            waiter_t* waiter = head_;
+            head_            = waiter->next;
+            if (!head_)
+            {
+                tail_ = nullptr;
+            }
+            waiting_.fetch_sub(1, std::memory_order_relaxed);
+
+            waiter->next = nullptr;
+            if (last)
+            {
+                last->next = waiter;
+            }
+            else
+            {
+                woken = waiter;
+            }
+            last = waiter;
+        }
+    }
+
+    // Waiters may be destroyed as soon as they're resumed
+    while (woken)
+    {
+        waiter_t* next = woken->next;
+        woken->wake(*woken);
+        woken = next;
+    }
+}
@@ -1,18 +1,91 @@
 #include <coop/event.hpp>
 
+#include <cassert>
 #include <coop/scheduler.hpp>
+#include <cstdint>
 #include <utility>
 
 #if defined(_WIN32)
 #    define WIN32_LEAN_AND_MEAN
 #    include <Windows.h>
 #elif defined(__linux__)
-# include <pthread.h>
+#    include <cerrno>
+#    include <cstdio>
+#    include <poll.h>
+#    include <sys/eventfd.h>
+#    include <unistd.h>
+#    include <vector>
 #elif (__APPLE__)
 #endif
 
 using namespace coop;
 
+#if defined(__linux__)
+namespace
+{
+// On Linux, events are backed by an eventfd. The handle stores the file
+// descriptor offset by one (so that a null handle is never a valid event) in
+// the upper bits, and whether the event is manually reset in the lowest bit.
+void* encode_handle(int fd, bool manual_reset) noexcept
+{
+    return reinterpret_cast<void*>(
+        (static_cast<uintptr_t>(fd + 1) << 1) | (manual_reset ? 1 : 0));
+}
+
+int handle_fd(void* handle) noexcept
+{
+    return event_ref_t{handle}.fd();
+}
+
+bool handle_manual_reset(void* handle) noexcept
+{
+    return reinterpret_cast<uintptr_t>(handle) & 1;
+}
+
+// Consumes the signal of an event without blocking, returning false if it
+// isn't signaled. Reading an eventfd resets its counter to zero, so at most
+// one reader observes each signal, as with an auto-reset event.
+bool try_consume(int fd) noexcept
+{
+    uint64_t value;
+    return read(fd, &value, sizeof(value)) == sizeof(value);
+}
+
+// Waits for any of the events to be readable without consuming their signals
+// (a timeout of -1 waits indefinitely). Returns the index of the first
+// readable event, or -1 on failure or timeout.
+int poll_events(event_ref_t const* events, uint32_t count, int timeout) noexcept
+{
+    thread_local std::vector<pollfd> fds;
+    fds.resize(count);
+    for (uint32_t i = 0; i != count; ++i)
+    {
+        fds[i] = {handle_fd(events[i].handle()), POLLIN, 0};
+    }
+
+    int result;
+    do
+    {
+        result = poll(fds.data(), count, timeout);
+    } while (result < 0 && errno == EINTR);
+
+    if (result <= 0)
+    {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i != count; ++i)
+    {
+        if (fds[i].revents != 0)
+        {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+} // namespace
+#endif
+
 event_ref_t::wait_result_t
 event_ref_t::wait_many(event_ref_t* events, uint32_t count)
 {
@@ -42,18 +115,43 @@ event_ref_t::wait_many(event_ref_t* events, uint32_t count)
     }
 
 #elif defined(__linux__)
-    // TODO: Android/Linux implementation
+    while (true)
+    {
+        int index = poll_events(events, count, -1);
+        if (index < 0)
+        {
+            return {status_e::failed};
+        }
+
+        // Auto-reset events are only considered signaled if we win the race
+        // to consume the signal. Otherwise, wait again.
+        void* handle = events[index].handle();
+        if (handle_manual_reset(handle) || try_consume(handle_fd(handle)))
+        {
+            return {status_e::normal, static_cast<uint32_t>(index)};
+        }
+    }
 #elif (__APPLE__)
     // TODO: MacOS/iOS implementation
 #endif
 }
 
-void event_ref_t::init(bool manual_reset, char const* label)
+// Events are anonymous outside of Windows
+void event_ref_t::init(bool manual_reset, [[maybe_unused]] char const* label)
 {
 #if defined(_WIN32)
     handle_ = CreateEventA(nullptr, manual_reset, false, label);
 #elif defined(__linux__)
-    // TODO: Android/Linux implementation
+    // Events are awaited on the scheduler's event thread, so reads must never
+    // block there. Blocking waits poll first.
+    int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (fd < 0)
+    {
+        perror("Failed to create eventfd");
+        handle_ = nullptr;
+        return;
+    }
+    handle_ = encode_handle(fd, manual_reset);
 #elif (__APPLE__)
     // TODO: MacOS/iOS implementation
 #endif
@@ -65,7 +163,12 @@ bool event_ref_t::is_signaled() const
     uint32_t status = WaitForSingleObject(handle_, 0);
     return status == WAIT_OBJECT_0;
 #elif defined(__linux__)
-    // TODO: Android/Linux implementation
+    // As on Windows, checking an auto-reset event consumes its signal
+    if (handle_manual_reset(handle_))
+    {
+        return poll_events(this, 1, 0) == 0;
+    }
+    return try_consume(handle_fd(handle_));
 #elif (__APPLE__)
     // TODO: MacOS/iOS implementation
 #endif
@@ -77,7 +180,8 @@ bool event_ref_t::wait() const
     uint32_t status = WaitForSingleObject(handle_, INFINITE);
     return status == WAIT_OBJECT_0;
 #elif defined(__linux__)
-    // TODO: Android/Linux implementation
+    return wait_many(const_cast<event_ref_t*>(this), 1).status
+           == status_e::normal;
 #elif (__APPLE__)
     // TODO: MacOS/iOS implementation
 #endif
@@ -88,7 +192,12 @@ void event_ref_t::signal()
 #if defined(_WIN32)
     SetEvent(handle_);
 #elif defined(__linux__)
-    // TODO: Android/Linux implementation
+    // Signaling an already signaled event leaves it signaled (the counter
+    // accumulates but is reset in full by a single read)
+    uint64_t value = 1;
+    [[maybe_unused]] ssize_t result
+        = write(handle_fd(handle_), &value, sizeof(value));
+    assert(result == sizeof(value) && "Failed to signal event");
 #elif (__APPLE__)
     // TODO: MacOS/iOS implementation
 #endif
@@ -99,17 +208,53 @@ void event_ref_t::reset()
 #if defined(_WIN32)
     ResetEvent(handle_);
 #elif defined(__linux__)
-    // TODO: Android/Linux implementation
+    try_consume(handle_fd(handle_));
 #elif (__APPLE__)
     // TODO: MacOS/iOS implementation
 #endif
 }
 
-void event_t::await_suspend(std::coroutine_handle<> coroutine) noexcept
+detail::event_awaiter_t::event_awaiter_t(event_ref_t event,
+                                         cpu_mask_t cpu_affinity,
+                                         uint32_t priority) noexcept
+    : event_{event}
+    , cpu_affinity_{std::move(cpu_affinity)}
+    , priority_{priority}
+{
+    wake = [](waiter_t& waiter) noexcept {
+        auto& self = static_cast<event_awaiter_t&>(waiter);
+        scheduler_t::instance().schedule(
+            self.coroutine, self.cpu_affinity_, self.priority_);
+    };
+
+#if defined(__linux__)
+    // The reactor reports each signal to every waiter, but only one waiter
+    // may consume an auto-reset event's signal
+    claim = [](reactor_waiter_t& waiter) noexcept {
+        auto& self   = static_cast<event_awaiter_t&>(waiter);
+        void* handle = self.event_.handle();
+        if (handle_manual_reset(handle))
+        {
+            return poll_events(&self.event_, 1, 0) == 0;
+        }
+        return try_consume(handle_fd(handle));
+    };
+#endif
+}
+
+bool detail::event_awaiter_t::await_suspend(std::coroutine_handle<> coroutine) noexcept
 {
-    // Enqueue coroutine for resumption when this event transitions to the
-    // signaled state
-    scheduler_t::instance().schedule(coroutine, ref(), cpu_affinity_, priority_);
+    this->coroutine = coroutine;
+
+    // The coroutine may be resumed on another thread before this returns, so
+    // the awaiter must not be accessed once it's queued
+    if (scheduler_t::instance().schedule(*this, event_))
+    {
+        return true;
+    }
+    perror("Failed to await event");
+    signaled_ = false;
+    return false;
 }
 
 event_t::~event_t() noexcept
@@ -120,7 +265,12 @@ event_t::~event_t() noexcept
         CloseHandle(handle_);
     }
 #elif defined(__linux__)
-    // TODO: Android/Linux implementation
+    if (handle_)
+    {
+        // The descriptor's number may be reused once it's closed
+        detail::reactor_t::forget(handle_fd(handle_));
+        close(handle_fd(handle_));
+    }
 #elif (__APPLE__)
     // TODO: MacOS/iOS implementation
 #endif
@@ -135,10 +285,8 @@ event_t& event_t::operator=(event_t&& other) noexcept
 {
     if (this != &other)
     {
-#if defined(_WIN32)
+#if defined(_WIN32) || defined(__linux__)
         std::swap(handle_, other.handle_);
-#elif defined(__linux__)
-        // TODO: Android/Linux implementation
 #elif (__APPLE__)
         // TODO: MacOS/iOS implementation
 #endif
@@ -148,12 +296,10 @@ event_t& event_t::operator=(event_t&& other) noexcept
 
 event_ref_t event_t::ref() const noexcept
 {
-#if defined(_WIN32)
+#if defined(_WIN32) || defined(__linux__)
     event_ref_t out;
     out.handle_ = handle_;
     return out;
-#elif defined(__linux__)
-    // TODO: Android/Linux implementation
 #elif (__APPLE__)
     // TODO: MacOS/iOS implementation
 #endif
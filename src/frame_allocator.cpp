@@ -0,0 +1,178 @@
+#include <coop/detail/frame_allocator.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <new>
+
+using namespace coop::detail;
+
+namespace
+{
+// Frames are carved out of slabs aligned to their size, so the slab (and its
+// owner) is found from a frame's address without any per-frame header. Each
+// slab holds frames of a single size class.
+constexpr size_t slab_size      = 64 * 1024;
+constexpr size_t granularity    = 64;
+constexpr size_t class_count    = 32;
+constexpr size_t max_frame_size = granularity * class_count;
+
+struct frame_block_t
+{
+    frame_block_t* next;
+};
+
+struct frame_cache_t;
+
+// Occupies the first `granularity` bytes of each slab
+struct slab_header_t
+{
+    frame_cache_t* owner;
+    size_t size_class;
+};
+
+struct alignas(64) frame_cache_t
+{
+    // Only accessed by the thread owning the cache
+    frame_block_t* free[class_count] = {};
+
+    // Frames freed by other threads, pushed without a lock and reclaimed all
+    // at once by the owner
+    alignas(64) std::atomic<frame_block_t*> remote{nullptr};
+
+    frame_cache_t* next_orphan = nullptr;
+};
+
+// Caches outlive their threads, as frames allocated by an exited thread may
+// still be in use. The caches of exited threads are adopted by new threads.
+std::mutex orphan_mutex;
+frame_cache_t* orphans = nullptr;
+
+struct cache_holder_t
+{
+    frame_cache_t* cache = nullptr;
+
+    ~cache_holder_t() noexcept
+    {
+        if (cache)
+        {
+            std::lock_guard lock{orphan_mutex};
+            cache->next_orphan = orphans;
+            orphans            = cache;
+            cache              = nullptr;
+        }
+    }
+};
+
+thread_local cache_holder_t holder;
+
+frame_cache_t& local_cache()
+{
+    if (!holder.cache)
+    {
+        {
+            std::lock_guard lock{orphan_mutex};
+            if (orphans)
+            {
+                holder.cache = orphans;
+                orphans      = orphans->next_orphan;
+            }
+        }
+
+        if (!holder.cache)
+        {
+            holder.cache = new frame_cache_t{};
+        }
+    }
+    return *holder.cache;
+}
+
+slab_header_t* slab_of(void* frame) noexcept
+{
+    return reinterpret_cast<slab_header_t*>(reinterpret_cast<uintptr_t>(frame)
+                                            & ~(slab_size - 1));
+}
+
+// Moves frames freed by other threads to the owner's free lists
+void reclaim(frame_cache_t& cache) noexcept
+{
+    frame_block_t* block
+        = cache.remote.exchange(nullptr, std::memory_order_acquire);
+    while (block)
+    {
+        frame_block_t* next    = block->next;
+        size_t size_class      = slab_of(block)->size_class;
+        block->next            = cache.free[size_class];
+        cache.free[size_class] = block;
+        block                  = next;
+    }
+}
+
+void refill(frame_cache_t& cache, size_t size_class)
+{
+    char* slab = static_cast<char*>(
+        ::operator new(slab_size, std::align_val_t{slab_size}));
+    new (slab) slab_header_t{&cache, size_class};
+
+    size_t frame_size = (size_class + 1) * granularity;
+    for (size_t offset = granularity; offset + frame_size <= slab_size;
+         offset += frame_size)
+    {
+        auto* block            = reinterpret_cast<frame_block_t*>(slab + offset);
+        block->next            = cache.free[size_class];
+        cache.free[size_class] = block;
+    }
+}
+} // namespace
+
+void* coop::detail::allocate_frame(size_t size)
+{
+    if (size > max_frame_size)
+    {
+        return ::operator new(size);
+    }
+
+    size_t size_class    = (size - 1) / granularity;
+    frame_cache_t& cache = local_cache();
+    if (!cache.free[size_class])
+    {
+        reclaim(cache);
+        if (!cache.free[size_class])
+        {
+            refill(cache, size_class);
+        }
+    }
+
+    frame_block_t* block   = cache.free[size_class];
+    cache.free[size_class] = block->next;
+    return block;
+}
+
+void coop::detail::deallocate_frame(void* frame, size_t size) noexcept
+{
+    if (size > max_frame_size)
+    {
+        ::operator delete(frame, size);
+        return;
+    }
+
+    auto* block         = static_cast<frame_block_t*>(frame);
+    slab_header_t* slab = slab_of(frame);
+    if (slab->owner == holder.cache)
+    {
+        frame_block_t*& head = holder.cache->free[slab->size_class];
+        block->next          = head;
+        head                 = block;
+        return;
+    }
+
+    // Only the owner removes frames from its remote list (and only by taking
+    // the entire list), so pushing is free of ABA hazards
+    std::atomic<frame_block_t*>& remote = slab->owner->remote;
+    frame_block_t* head                 = remote.load(std::memory_order_relaxed);
+    do
+    {
+        block->next = head;
+    } while (!remote.compare_exchange_weak(
+        head, block, std::memory_order_release, std::memory_order_relaxed));
+}
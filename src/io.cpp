@@ -0,0 +1,671 @@
+#include <coop/io.hpp>
+
+#if defined(__linux__)
+
+#    include <algorithm>
+#    include <cassert>
+#    include <cerrno>
+#    include <coop/detail/tracer.hpp>
+#    include <coop/detail/work_queue.hpp>
+#    include <cstdio>
+#    include <cstring>
+#    include <linux/io_uring.h>
+#    include <linux/mempolicy.h>
+#    include <poll.h>
+#    include <sched.h>
+#    include <sys/eventfd.h>
+#    include <sys/mman.h>
+#    include <sys/syscall.h>
+#    include <sys/uio.h>
+#    include <unistd.h>
+
+using namespace coop;
+using namespace coop::detail;
+
+namespace
+{
+// Raw system calls are used to avoid a dependency on liburing
+int io_uring_setup(uint32_t entries, io_uring_params* params) noexcept
+{
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int io_uring_enter(int fd,
+                   uint32_t to_submit,
+                   uint32_t min_complete,
+                   uint32_t flags) noexcept
+{
+    return static_cast<int>(syscall(
+        __NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+int io_uring_register(int fd,
+                      uint32_t opcode,
+                      void const* arg,
+                      uint32_t count) noexcept
+{
+    return static_cast<int>(
+        syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+// The ring indices are shared with the kernel
+uint32_t load_acquire(uint32_t* value) noexcept
+{
+    return std::atomic_ref<uint32_t>{*value}.load(std::memory_order_acquire);
+}
+
+void store_release(uint32_t* value, uint32_t desired) noexcept
+{
+    std::atomic_ref<uint32_t>{*value}.store(desired, std::memory_order_release);
+}
+} // namespace
+
+// The buffers of a single NUMA node, which are registered as one fixed buffer
+struct io_service_t::buffer_region_t
+{
+    uint32_t node = 0;
+    void* data    = nullptr;
+    size_t size   = 0;
+    moodycamel::ConcurrentQueue<io_buffer_node_t*> free;
+};
+
+io_buffer_t::~io_buffer_t() noexcept
+{
+    if (node_)
+    {
+        service_->release(node_);
+    }
+}
+
+io_buffer_t::io_buffer_t(io_buffer_t&& other) noexcept
+    : service_{other.service_}
+    , node_{other.node_}
+{
+    other.node_ = nullptr;
+}
+
+io_buffer_t& io_buffer_t::operator=(io_buffer_t&& other) noexcept
+{
+    if (this != &other)
+    {
+        if (node_)
+        {
+            service_->release(node_);
+        }
+        service_    = other.service_;
+        node_       = other.node_;
+        other.node_ = nullptr;
+    }
+    return *this;
+}
+
+io_service_t& io_service_t::instance() noexcept
+{
+    static io_service_t io_service;
+    return io_service;
+}
+
+io_service_t::io_service_t(uint32_t entries, bool use_io_uring)
+{
+    active_       = true;
+    wake_pending_ = false;
+
+    if (use_io_uring && !setup(entries))
+    {
+        COOP_LOG("io_uring unavailable (%s), falling back to pread/pwrite\n",
+                 std::strerror(errno));
+    }
+
+    if (uses_io_uring())
+    {
+        thread_ = std::thread([this] { run_ring(); });
+    }
+    else
+    {
+        thread_ = std::thread([this] { run_fallback(); });
+    }
+}
+
+io_service_t::~io_service_t() noexcept
+{
+    active_ = false;
+    if (uses_io_uring())
+    {
+        uint64_t value = 1;
+        [[maybe_unused]] ssize_t result
+            = ::write(wake_fd_, &value, sizeof(value));
+    }
+    else
+    {
+        fallback_sem_.release();
+    }
+    thread_.join();
+
+    if (uses_io_uring())
+    {
+        munmap(sqes_, sqes_size_);
+        if (cq_ring_ != sq_ring_)
+        {
+            munmap(cq_ring_, cq_ring_size_);
+        }
+        munmap(sq_ring_, sq_ring_size_);
+        close(ring_fd_);
+        close(wake_fd_);
+    }
+
+    release_buffers();
+}
+
+bool io_service_t::setup(uint32_t entries)
+{
+    io_uring_params params{};
+    int fd = io_uring_setup(entries, &params);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    cq_ring_size_
+        = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+
+    // Recent kernels map both rings with a single mapping
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap)
+    {
+        sq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+        cq_ring_size_ = sq_ring_size_;
+    }
+
+    sq_ring_ = mmap(nullptr,
+                    sq_ring_size_,
+                    PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE,
+                    fd,
+                    IORING_OFF_SQ_RING);
+    cq_ring_ = single_mmap ? sq_ring_
+                           : mmap(nullptr,
+                                  cq_ring_size_,
+                                  PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_POPULATE,
+                                  fd,
+                                  IORING_OFF_CQ_RING);
+    sqes_    = mmap(nullptr,
+                 sqes_size_,
+                 PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE,
+                 fd,
+                 IORING_OFF_SQES);
+    wake_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    if (sq_ring_ == MAP_FAILED || cq_ring_ == MAP_FAILED || sqes_ == MAP_FAILED
+        || wake_fd_ < 0)
+    {
+        int error = errno;
+        if (sqes_ != MAP_FAILED)
+        {
+            munmap(sqes_, sqes_size_);
+        }
+        if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_)
+        {
+            munmap(cq_ring_, cq_ring_size_);
+        }
+        if (sq_ring_ != MAP_FAILED)
+        {
+            munmap(sq_ring_, sq_ring_size_);
+        }
+        if (wake_fd_ >= 0)
+        {
+            close(wake_fd_);
+        }
+        close(fd);
+        errno = error;
+        return false;
+    }
+
+    auto* sq    = static_cast<char*>(sq_ring_);
+    sq_head_    = reinterpret_cast<uint32_t*>(sq + params.sq_off.head);
+    sq_tail_    = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+    sq_array_   = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+    sq_mask_    = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+    sq_entries_ = params.sq_entries;
+
+    auto* cq = static_cast<char*>(cq_ring_);
+    cq_head_ = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+    cqes_    = cq + params.cq_off.cqes;
+    cq_mask_ = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+
+    ring_fd_ = fd;
+
+    std::lock_guard lock{mutex_};
+    push_wake();
+    return true;
+}
+
+bool io_service_t::register_buffers(uint32_t size,
+                                    uint32_t count,
+                                    scheduler_t& scheduler)
+{
+    assert(!regions_ && "Buffers may only be registered once");
+    assert(size != 0 && count != 0);
+
+    // Page aligned buffers may also be used with O_DIRECT
+    size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size = static_cast<uint32_t>((size + page_size - 1) & ~(page_size - 1));
+
+    // Each NUMA node spanned by the workers receives a region of buffers
+    topology_t const& topology = scheduler.topology();
+    uint32_t worker_count      = scheduler.worker_count();
+    std::vector<uint32_t> nodes;
+    std::vector<uint32_t> node_workers;
+    for (uint32_t i = 0; i != worker_count; ++i)
+    {
+        uint32_t node = topology.node(scheduler.worker_cpu(i));
+        auto it       = std::find(nodes.begin(), nodes.end(), node);
+        if (it == nodes.end())
+        {
+            nodes.push_back(node);
+            node_workers.push_back(1);
+        }
+        else
+        {
+            ++node_workers[it - nodes.begin()];
+        }
+    }
+
+    region_count_ = static_cast<uint32_t>(nodes.size());
+    void* raw     = operator new[](sizeof(buffer_region_t) * region_count_);
+    regions_      = static_cast<buffer_region_t*>(raw);
+    buffer_nodes_ = new io_buffer_node_t[region_count_ * count];
+    std::vector<iovec> iovecs(region_count_);
+
+    uint32_t max_node_workers = 1;
+    for (uint32_t i = 0; i != region_count_; ++i)
+    {
+        buffer_region_t& region = *new (regions_ + i) buffer_region_t{};
+        region.node             = nodes[i];
+        region.size             = size_t{size} * count;
+        region.data             = mmap(nullptr,
+                                       region.size,
+                                       PROT_READ | PROT_WRITE,
+                                       MAP_PRIVATE | MAP_ANONYMOUS,
+                                       -1,
+                                       0);
+        if (region.data == MAP_FAILED)
+        {
+            // Unwind the regions constructed so far, including this one
+            perror("Failed to allocate I/O buffers");
+            region.data   = nullptr;
+            region_count_ = i + 1;
+            release_buffers();
+            return false;
+        }
+
+        // Pages are placed when first touched, so set the region's preferred
+        // node and then fault its pages in. Setting the policy fails
+        // harmlessly on kernels without NUMA support.
+        constexpr uint32_t max_nodes       = 1024;
+        unsigned long mask[max_nodes / 64] = {};
+        if (nodes[i] < max_nodes)
+        {
+            mask[nodes[i] / 64] = 1ul << (nodes[i] % 64);
+            syscall(__NR_mbind,
+                    region.data,
+                    region.size,
+                    MPOL_PREFERRED,
+                    mask,
+                    max_nodes + 1,
+                    0);
+        }
+        std::memset(region.data, 0, region.size);
+
+        iovecs[i].iov_base = region.data;
+        iovecs[i].iov_len  = region.size;
+        for (uint32_t j = 0; j != count; ++j)
+        {
+            io_buffer_node_t& node = buffer_nodes_[i * count + j];
+            node.data   = static_cast<char*>(region.data) + size_t{size} * j;
+            node.region = i;
+            region.free.enqueue(&node);
+        }
+        max_node_workers = std::max(max_node_workers, node_workers[i]);
+    }
+
+    buffer_scheduler_ = &scheduler;
+    buffer_size_      = size;
+    buffer_lists_     = new buffer_list_t[worker_count];
+    for (uint32_t i = 0; i != worker_count; ++i)
+    {
+        buffer_lists_[i].region = region(topology.node(scheduler.worker_cpu(i)));
+    }
+
+    // Workers may cache at most half of their node's buffers between them, so
+    // that buffers released by one worker remain available to its peers
+    buffer_list_limit_ = count / (2 * max_node_workers);
+
+    if (uses_io_uring())
+    {
+        buffers_registered_ = io_uring_register(ring_fd_,
+                                                IORING_REGISTER_BUFFERS,
+                                                iovecs.data(),
+                                                region_count_)
+                              == 0;
+        if (!buffers_registered_)
+        {
+            COOP_LOG("Failed to register I/O buffers (%s)\n",
+                     std::strerror(errno));
+        }
+    }
+    return true;
+}
+
+void io_service_t::release_buffers() noexcept
+{
+    if (!regions_)
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i != region_count_; ++i)
+    {
+        if (regions_[i].data)
+        {
+            munmap(regions_[i].data, regions_[i].size);
+        }
+        regions_[i].~buffer_region_t();
+    }
+    operator delete[](regions_);
+    delete[] buffer_nodes_;
+    delete[] buffer_lists_;
+    regions_      = nullptr;
+    region_count_ = 0;
+    buffer_nodes_ = nullptr;
+    buffer_lists_ = nullptr;
+}
+
+io_service_t::buffer_list_t* io_service_t::local_buffers() const noexcept
+{
+    work_queue_t* queue = work_queue_t::current();
+    if (queue && &queue->scheduler() == buffer_scheduler_)
+    {
+        return buffer_lists_ + queue->id();
+    }
+    return nullptr;
+}
+
+uint32_t io_service_t::region(uint32_t node) const noexcept
+{
+    for (uint32_t i = 0; i != region_count_; ++i)
+    {
+        if (regions_[i].node == node)
+        {
+            return i;
+        }
+    }
+    return 0;
+}
+
+io_buffer_t io_service_t::lease_buffer() noexcept
+{
+    if (!regions_)
+    {
+        return {};
+    }
+
+    buffer_list_t* list = local_buffers();
+    if (list && list->head)
+    {
+        io_buffer_node_t* node = list->head;
+        list->head             = node->next;
+        --list->size;
+        return {this, node};
+    }
+
+    // Otherwise, take a buffer from the calling thread's node if possible
+    uint32_t first = 0;
+    if (list)
+    {
+        first = list->region;
+    }
+    else
+    {
+        int cpu                    = sched_getcpu();
+        topology_t const& topology = buffer_scheduler_->topology();
+        if (cpu >= 0 && static_cast<uint32_t>(cpu) < topology.cpu_count())
+        {
+            first = region(topology.node(static_cast<uint32_t>(cpu)));
+        }
+    }
+
+    for (uint32_t i = 0; i != region_count_; ++i)
+    {
+        io_buffer_node_t* node;
+        if (regions_[(first + i) % region_count_].free.try_dequeue(node))
+        {
+            return {this, node};
+        }
+    }
+    return {};
+}
+
+void io_service_t::release(io_buffer_node_t* node) noexcept
+{
+    // Buffers from other nodes are returned to their own region so that they
+    // aren't reused away from their memory
+    buffer_list_t* list = local_buffers();
+    if (list && list->region == node->region && list->size < buffer_list_limit_)
+    {
+        node->next = list->head;
+        list->head = node;
+        ++list->size;
+        return;
+    }
+
+    regions_[node->region].free.enqueue(node);
+}
+
+void io_service_t::submit(io_op_t* op)
+{
+    COOP_LOG("Submitting operation %u of %u bytes on fd %i\n",
+             static_cast<uint32_t>(op->opcode),
+             op->size,
+             op->fd);
+
+    if (!uses_io_uring())
+    {
+        fallback_queue_.enqueue(op);
+        fallback_sem_.release();
+        return;
+    }
+
+    {
+        std::lock_guard lock{mutex_};
+        push(op);
+    }
+
+    // The completion thread flushes every SQE appended before it consumes the
+    // wakeup, so only the first submitter of each batch needs to signal it
+    if (!wake_pending_.exchange(true, std::memory_order_acq_rel))
+    {
+        uint64_t value = 1;
+        [[maybe_unused]] ssize_t result
+            = ::write(wake_fd_, &value, sizeof(value));
+    }
+}
+
+void io_service_t::push(io_op_t* op) noexcept
+{
+    uint32_t tail = reserve();
+
+    auto& sqe = static_cast<io_uring_sqe*>(sqes_)[tail & sq_mask_];
+    std::memset(&sqe, 0, sizeof(sqe));
+    switch (op->opcode)
+    {
+    case io_op_t::opcode_e::read:
+        sqe.opcode = IORING_OP_READ;
+        break;
+    case io_op_t::opcode_e::write:
+        sqe.opcode = IORING_OP_WRITE;
+        break;
+    case io_op_t::opcode_e::read_fixed:
+        sqe.opcode = buffers_registered_ ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe.buf_index = static_cast<uint16_t>(op->buffer_index);
+        break;
+    case io_op_t::opcode_e::write_fixed:
+        sqe.opcode
+            = buffers_registered_ ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe.buf_index = static_cast<uint16_t>(op->buffer_index);
+        break;
+    }
+    sqe.fd        = op->fd;
+    sqe.addr      = reinterpret_cast<uint64_t>(op->buffer);
+    sqe.len       = op->size;
+    sqe.off       = op->offset;
+    sqe.user_data = reinterpret_cast<uint64_t>(op);
+
+    sq_array_[tail & sq_mask_] = tail & sq_mask_;
+    store_release(sq_tail_, tail + 1);
+    ++unsubmitted_;
+}
+
+void io_service_t::push_wake() noexcept
+{
+    uint32_t tail = reserve();
+
+    // A user data of zero identifies the wake event's completion
+    auto& sqe = static_cast<io_uring_sqe*>(sqes_)[tail & sq_mask_];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode        = IORING_OP_POLL_ADD;
+    sqe.fd            = wake_fd_;
+    sqe.poll32_events = POLLIN;
+    sqe.user_data     = 0;
+
+    sq_array_[tail & sq_mask_] = tail & sq_mask_;
+    store_release(sq_tail_, tail + 1);
+    ++unsubmitted_;
+}
+
+uint32_t io_service_t::reserve() noexcept
+{
+    uint32_t tail = *sq_tail_;
+    while (tail - load_acquire(sq_head_) == sq_entries_)
+    {
+        // The ring is full. Submitted SQEs are consumed by the kernel
+        // immediately (well before they complete), so flushing makes room
+        // unless the kernel is applying backpressure, in which case the
+        // completion thread must first reap completions.
+        flush();
+        if (tail - load_acquire(sq_head_) == sq_entries_)
+        {
+            std::this_thread::yield();
+        }
+    }
+    return tail;
+}
+
+void io_service_t::flush() noexcept
+{
+    while (unsubmitted_ != 0)
+    {
+        int result = io_uring_enter(ring_fd_, unsubmitted_, 0, 0);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            // EAGAIN and EBUSY indicate the completion queue is backed up, so
+            // the remaining SQEs are submitted on a later flush
+            if (errno != EAGAIN && errno != EBUSY)
+            {
+                perror("Failed to submit to io_uring");
+            }
+            return;
+        }
+        unsubmitted_ -= static_cast<uint32_t>(result);
+    }
+}
+
+void io_service_t::run_ring() noexcept
+{
+    while (true)
+    {
+        {
+            std::lock_guard lock{mutex_};
+            flush();
+        }
+
+        if (io_uring_enter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS) < 0
+            && errno != EINTR)
+        {
+            perror("Failed to wait on io_uring");
+        }
+
+        bool woken    = false;
+        uint32_t head = *cq_head_;
+        uint32_t tail = load_acquire(cq_tail_);
+        for (; head != tail; ++head)
+        {
+            auto& cqe = static_cast<io_uring_cqe*>(cqes_)[head & cq_mask_];
+            if (cqe.user_data == 0)
+            {
+                woken = true;
+                continue;
+            }
+
+            auto* op   = reinterpret_cast<io_op_t*>(cqe.user_data);
+            op->result = cqe.res;
+            op->complete(op);
+        }
+        store_release(cq_head_, head);
+
+        if (woken)
+        {
+            if (!active_)
+            {
+                return;
+            }
+
+            // Clear the flag before the next flush so that any SQE appended
+            // after this point signals the wake event again
+            uint64_t value;
+            [[maybe_unused]] ssize_t result
+                = ::read(wake_fd_, &value, sizeof(value));
+            wake_pending_.store(false, std::memory_order_release);
+
+            std::lock_guard lock{mutex_};
+            push_wake();
+        }
+    }
+}
+
+void io_service_t::run_fallback() noexcept
+{
+    while (true)
+    {
+        fallback_sem_.acquire();
+
+        io_op_t* op;
+        if (!fallback_queue_.try_dequeue(op))
+        {
+            if (!active_)
+            {
+                return;
+            }
+            continue;
+        }
+
+        bool is_read   = op->opcode == io_op_t::opcode_e::read
+                       || op->opcode == io_op_t::opcode_e::read_fixed;
+        ssize_t result = is_read
+                             ? pread(op->fd, op->buffer, op->size, op->offset)
+                             : pwrite(op->fd, op->buffer, op->size, op->offset);
+        op->result = result < 0 ? -errno : static_cast<int32_t>(result);
+        op->complete(op);
+    }
+}
+
+#endif
@@ -0,0 +1,80 @@
+#include <coop/mutex.hpp>
+
+#include <cassert>
+
+using namespace coop;
+
+async_mutex_t::~async_mutex_t() noexcept
+{
+    [[maybe_unused]] uintptr_t state = state_.load(std::memory_order_relaxed);
+    assert(state <= locked && !waiters_
+           && "Mutex destroyed with coroutines waiting on it");
+}
+
+bool async_mutex_t::lock_or_wait(detail::waiter_t& waiter) noexcept
+{
+    uintptr_t state = state_.load(std::memory_order_relaxed);
+    while (true)
+    {
+        if (state == unlocked)
+        {
+            if (state_.compare_exchange_weak(
+                    state, locked, std::memory_order_acquire, std::memory_order_relaxed))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            // Push onto the waiters that arrived since the holder last took
+            // them. The holder reverses them to restore their arrival order.
+            waiter.next = state == locked
+                              ? nullptr
+                              : reinterpret_cast<detail::waiter_t*>(state);
+            if (state_.compare_exchange_weak(state,
+                                             reinterpret_cast<uintptr_t>(&waiter),
+                                             std::memory_order_release,
+                                             std::memory_order_relaxed))
+            {
+                return true;
+            }
+        }
+    }
+}
+
+void async_mutex_t::unlock(handoff_e handoff) noexcept
+{
+    if (!waiters_)
+    {
+        uintptr_t state = locked;
+        if (state_.compare_exchange_strong(
+                state, unlocked, std::memory_order_release, std::memory_order_relaxed))
+        {
+            return;
+        }
+
+        // Take every waiter that has arrived, leaving the mutex locked
+        state = state_.exchange(locked, std::memory_order_acquire);
+        auto* waiter = reinterpret_cast<detail::waiter_t*>(state);
+        while (waiter)
+        {
+            detail::waiter_t* next = waiter->next;
+            waiter->next           = waiters_;
+            waiters_               = waiter;
+            waiter                 = next;
+        }
+    }
+
+    // The mutex stays locked on behalf of the next waiter, which becomes the
+    // holder (and owner of the remaining waiters) as soon as it's resumed
+    detail::waiter_t* next = waiters_;
+    waiters_               = next->next;
+    if (handoff == handoff_e::immediate)
+    {
+        next->coroutine.resume();
+    }
+    else
+    {
+        next->wake(*next);
+    }
+}
@@ -0,0 +1,332 @@
+#include <coop/detail/reactor.hpp>
+
+#if defined(__linux__)
+
+#    include <cassert>
+#    include <cerrno>
+#    include <coop/detail/tracer.hpp>
+#    include <cstdio>
+#    include <mutex>
+#    include <new>
+#    include <sys/epoll.h>
+#    include <sys/eventfd.h>
+#    include <unistd.h>
+
+using namespace coop;
+using namespace coop::detail;
+
+// A descriptor awaited through reactor_t::wait. Readiness is reported for
+// both directions with a single edge-triggered registration, which stays in
+// place across waits.
+struct reactor_t::registration_t
+{
+    struct list_t
+    {
+        reactor_waiter_t* head = nullptr;
+        reactor_waiter_t* tail = nullptr;
+    };
+
+    std::mutex mutex;
+    bool registered = false;
+
+    // Set while the descriptor is awaited without a claim function, in which
+    // case it may be closed without being forgotten and the registration may
+    // belong to a previous descriptor with the same number
+    bool stale = false;
+
+    // Waiters for readability and writability respectively, oldest first
+    list_t lists[2];
+};
+
+namespace
+{
+// Every live reactor, for reactor_t::forget
+std::mutex& reactors_mutex() noexcept
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+reactor_t*& reactors() noexcept
+{
+    static reactor_t* head = nullptr;
+    return head;
+}
+} // namespace
+
+reactor_t::reactor_t()
+{
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd_  = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (epoll_fd_ < 0 || wake_fd_ < 0)
+    {
+        perror("Failed to create reactor");
+        return;
+    }
+
+    epoll_event event{};
+    event.events   = EPOLLIN;
+    event.data.ptr = nullptr;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event);
+
+    {
+        std::lock_guard lock{reactors_mutex()};
+        next_      = reactors();
+        reactors() = this;
+    }
+
+    active_ = true;
+    thread_ = std::thread([this] {
+        // Readiness is dispatched in batches
+        epoll_event events[256];
+        while (active_)
+        {
+            int count = epoll_wait(epoll_fd_, events, 256, -1);
+            if (count < 0)
+            {
+                if (errno != EINTR)
+                {
+                    perror("Failed to wait on reactor");
+                }
+                continue;
+            }
+
+            COOP_LOG("Reactor dispatching %i operations\n", count);
+            for (int i = 0; i != count; ++i)
+            {
+                // Null user data indicates the wake event, which is only
+                // signaled when stopping
+                if (auto* registration
+                    = static_cast<registration_t*>(events[i].data.ptr))
+                {
+                    dispatch(*registration, events[i].events);
+                }
+            }
+        }
+    });
+}
+
+reactor_t::~reactor_t() noexcept
+{
+    stop();
+
+    if (epoll_fd_ >= 0)
+    {
+        std::lock_guard lock{reactors_mutex()};
+        for (reactor_t** it = &reactors(); *it; it = &(*it)->next_)
+        {
+            if (*it == this)
+            {
+                *it = next_;
+                break;
+            }
+        }
+    }
+
+    for (auto& chunk : chunks_)
+    {
+        delete[] chunk.load(std::memory_order_relaxed);
+    }
+
+    if (epoll_fd_ >= 0)
+    {
+        close(epoll_fd_);
+    }
+    if (wake_fd_ >= 0)
+    {
+        close(wake_fd_);
+    }
+}
+
+void reactor_t::stop() noexcept
+{
+    if (thread_.joinable())
+    {
+        active_        = false;
+        uint64_t value = 1;
+        [[maybe_unused]] ssize_t result
+            = write(wake_fd_, &value, sizeof(value));
+        thread_.join();
+    }
+}
+
+bool reactor_t::wait(int fd, uint32_t events, reactor_waiter_t& waiter) noexcept
+{
+    registration_t* registration = this->registration(fd, true);
+    if (!registration)
+    {
+        return false;
+    }
+
+    bool woken;
+    {
+        std::lock_guard lock{registration->mutex};
+        // Waiters without a claim function detect readiness predating them
+        // by rearming the registration, which also replaces a stale one
+        if (!registration->registered || registration->stale || !waiter.claim)
+        {
+            epoll_event event{};
+            event.events   = EPOLLIN | EPOLLOUT | EPOLLET;
+            event.data.ptr = registration;
+            int op = registration->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+            if (epoll_ctl(epoll_fd_, op, fd, &event) != 0)
+            {
+                // The descriptor may have been closed (dropping its
+                // registration) or reopened since it was last awaited
+                if (errno != (op == EPOLL_CTL_MOD ? ENOENT : EEXIST))
+                {
+                    return false;
+                }
+                op = op == EPOLL_CTL_MOD ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+                if (epoll_ctl(epoll_fd_, op, fd, &event) != 0)
+                {
+                    return false;
+                }
+            }
+            registration->registered = true;
+        }
+        registration->stale = !waiter.claim;
+
+        // Edges are only reported to waiters queued by the time they're
+        // dispatched, so readiness predating the waiter must be claimed here
+        woken = waiter.claim && waiter.claim(waiter);
+        if (!woken)
+        {
+            auto& list  = registration->lists[events & EPOLLOUT ? 1 : 0];
+            waiter.next = nullptr;
+            if (list.tail)
+            {
+                list.tail->next = &waiter;
+            }
+            else
+            {
+                list.head = &waiter;
+            }
+            list.tail = &waiter;
+        }
+    }
+
+    if (woken)
+    {
+        waiter.wake(waiter);
+    }
+    return true;
+}
+
+void reactor_t::forget(int fd) noexcept
+{
+    std::lock_guard lock{reactors_mutex()};
+    for (reactor_t* reactor = reactors(); reactor; reactor = reactor->next_)
+    {
+        registration_t* registration = reactor->registration(fd, false);
+        if (!registration)
+        {
+            continue;
+        }
+
+        std::lock_guard registration_lock{registration->mutex};
+        assert(!registration->lists[0].head && !registration->lists[1].head
+               && "Descriptor forgotten with waiters pending");
+        if (registration->registered)
+        {
+            epoll_ctl(reactor->epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+            registration->registered = false;
+            registration->stale      = false;
+        }
+    }
+}
+
+reactor_t::registration_t* reactor_t::registration(int fd, bool create) noexcept
+{
+    if (fd < 0 || static_cast<uint32_t>(fd) >= chunk_size * chunk_count)
+    {
+        errno = fd < 0 ? EBADF : EMFILE;
+        return nullptr;
+    }
+
+    auto& slot            = chunks_[static_cast<uint32_t>(fd) >> chunk_bits];
+    registration_t* chunk = slot.load(std::memory_order_acquire);
+    if (!chunk)
+    {
+        if (!create)
+        {
+            return nullptr;
+        }
+
+        auto* fresh = new (std::nothrow) registration_t[chunk_size];
+        if (!fresh)
+        {
+            errno = ENOMEM;
+            return nullptr;
+        }
+        // Another thread may have allocated the chunk in the meantime
+        if (slot.compare_exchange_strong(
+                chunk, fresh, std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+            chunk = fresh;
+        }
+        else
+        {
+            delete[] fresh;
+        }
+    }
+    return chunk + (fd & static_cast<int>(chunk_size - 1));
+}
+
+void reactor_t::dispatch(registration_t& registration, uint32_t events) noexcept
+{
+    // Errors and hangups are reported to waiters in both directions, which
+    // observe them when they retry
+    constexpr uint32_t masks[2]
+        = {EPOLLIN | EPOLLERR | EPOLLHUP, EPOLLOUT | EPOLLERR | EPOLLHUP};
+
+    waiter_t* woken = nullptr;
+    waiter_t* last  = nullptr;
+    {
+        std::lock_guard lock{registration.mutex};
+        for (uint32_t i = 0; i != 2; ++i)
+        {
+            if (!(events & masks[i]))
+            {
+                continue;
+            }
+
+            // Wake claimed waiters in order, keeping the rest queued
+            auto& list               = registration.lists[i];
+            reactor_waiter_t* waiter = list.head;
+            list.head                = nullptr;
+            list.tail                = nullptr;
+            while (waiter)
+            {
+                auto* next   = static_cast<reactor_waiter_t*>(waiter->next);
+                waiter->next = nullptr;
+                if (!waiter->claim || waiter->claim(*waiter))
+                {
+                    (last ? last->next : woken) = waiter;
+                    last                        = waiter;
+                }
+                else if (list.tail)
+                {
+                    list.tail->next = waiter;
+                    list.tail       = waiter;
+                }
+                else
+                {
+                    list.head = waiter;
+                    list.tail = waiter;
+                }
+                waiter = next;
+            }
+        }
+    }
+
+    // Waiters may be destroyed as soon as they're woken
+    while (woken)
+    {
+        waiter_t* next = woken->next;
+        woken->wake(*woken);
+        woken = next;
+    }
+}
+
+#endif
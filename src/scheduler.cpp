@@ -1,13 +1,19 @@
 #include <coop/scheduler.hpp>
 
+#include <algorithm>
 #include <bit>
 #include <cassert>
 #include <coop/detail/tracer.hpp>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <numbers>
 #include <thread>
 
+#if defined(__linux__)
+#    include <sys/epoll.h>
+#endif
+
 using namespace coop;
 
 scheduler_t& scheduler_t::instance() noexcept
@@ -16,24 +22,190 @@ scheduler_t& scheduler_t::instance() noexcept
     return scheduler;
 }
 
+scheduler_config_t scheduler_config_t::from_environment(scheduler_config_t config)
+{
+    if (char const* value = std::getenv("COOP_WORKER_COUNT"))
+    {
+        config.worker_count = std::strtoul(value, nullptr, 10);
+    }
+
+    if (char const* value = std::getenv("COOP_CPUS"))
+    {
+        config.cpus = cpu_mask_t::parse(value);
+        if (config.cpus.empty())
+        {
+            std::fprintf(stderr, "Ignoring invalid COOP_CPUS: %s\n", value);
+        }
+    }
+
+    if (char const* value = std::getenv("COOP_PINNING"))
+    {
+        if (std::strcmp(value, "hard") == 0)
+        {
+            config.pinning = pinning_e::hard;
+        }
+        else if (std::strcmp(value, "soft") == 0)
+        {
+            config.pinning = pinning_e::soft;
+        }
+        else if (std::strcmp(value, "none") == 0)
+        {
+            config.pinning = pinning_e::none;
+        }
+        else
+        {
+            std::fprintf(stderr, "Ignoring unknown COOP_PINNING: %s\n", value);
+        }
+    }
+
+    if (char const* value = std::getenv("COOP_QUEUE_CAPACITY"))
+    {
+        config.queue_capacity = std::strtoull(value, nullptr, 10);
+    }
+
+    if (char const* value = std::getenv("COOP_PRIORITY_COUNT"))
+    {
+        config.priority_count = std::strtoul(value, nullptr, 10);
+    }
+
+    if (char const* value = std::getenv("COOP_PRIORITY_WEIGHTS"))
+    {
+        config.priority_weights.clear();
+        while (*value >= '0' && *value <= '9')
+        {
+            char* end = nullptr;
+            config.priority_weights.push_back(std::strtoul(value, &end, 10));
+            value = *end == ',' ? end + 1 : end;
+        }
+    }
+
+    return config;
+}
+
 scheduler_t::scheduler_t()
+    : scheduler_t{scheduler_config_t::from_environment()}
 {
-    // Determine CPU count
-    cpu_count_ = std::thread::hardware_concurrency();
-    assert(cpu_count_ > 0 && cpu_count_ <= 64
-           && "Coop does not yet support CPUs with more than 64 cores");
-    cpu_mask_ = (1 << (cpu_count_ + 1)) - 1;
+}
 
-    COOP_LOG("Spawning coop scheduler with %i threads\n", cpu_count_);
+scheduler_t::scheduler_t(scheduler_config_t const& config)
+{
+    cpu_mask_t cpus = config.cpus;
+    if (cpus.empty())
+    {
+        // hardware_concurrency() counts every CPU on the host, including those
+        // excluded by the process's cpuset
+        cpus = topology_t::available_cpus();
+    }
+    else if (config.pinning != pinning_e::none)
+    {
+        // Workers can't be pinned to CPUs the process isn't permitted to use
+        cpu_mask_t available = cpus & topology_t::available_cpus();
+        if (available.empty())
+        {
+            COOP_LOG("None of the configured CPUs are available\n");
+        }
+        else
+        {
+            cpus = std::move(available);
+        }
+    }
+
+    worker_count_ = config.worker_count;
+    if (worker_count_ == 0)
+    {
+        // Workers beyond the cgroup CPU quota would only contend for the same
+        // CPU time, and risk being throttled while holding work
+        uint32_t quota = topology_t::cpu_quota();
+        worker_count_
+            = scheduler_config_t::default_worker_count(cpus.count(), quota);
+        if (worker_count_ < cpus.count())
+        {
+            COOP_LOG("Limiting workers to the cgroup CPU quota of %u\n", quota);
+        }
+    }
+
+    if (worker_count_ > cpus.count())
+    {
+        if (config.pinning == pinning_e::none)
+        {
+            for (uint32_t cpu = cpus.nth(cpus.count() - 1) + 1;
+                 cpus.count() != worker_count_;
+                 ++cpu)
+            {
+                cpus.set(cpu);
+            }
+        }
+        else
+        {
+            COOP_LOG("Limiting pinned workers to the %u available CPUs\n",
+                     cpus.count());
+            worker_count_ = cpus.count();
+        }
+    }
+
+    // Assign CPUs to workers in ascending order
+    worker_cpus_ = new uint32_t[worker_count_];
+    for (uint32_t i = 0, cpu = cpus.next(0); i != worker_count_;
+         ++i, cpu             = cpus.next(cpu + 1))
+    {
+        worker_cpus_[i] = cpu;
+        cpu_mask_.set(cpu);
+    }
+
+    cpu_limit_   = worker_cpus_[worker_count_ - 1] + 1;
+    cpu_workers_ = new uint32_t[cpu_limit_];
+    std::fill(cpu_workers_, cpu_workers_ + cpu_limit_, cpu_mask_t::npos);
+    for (uint32_t i = 0; i != worker_count_; ++i)
+    {
+        cpu_workers_[worker_cpus_[i]] = i;
+    }
+
+    topology_ = topology_t::discover(cpu_limit_);
+
+    priority_count_   = std::max(config.priority_count, 1u);
+    priority_weights_ = new uint32_t[priority_count_];
+    for (uint32_t i = 0; i != priority_count_; ++i)
+    {
+        priority_weights_[i] = i < config.priority_weights.size()
+                                   ? config.priority_weights[i]
+                                   : 1u << std::min(2 * i, 30u);
+        priority_weights_[i] = std::max(priority_weights_[i], 1u);
+    }
+
+    idle_word_count_ = (cpu_limit_ + 63) / 64;
+    idle_            = new idle_word_t[idle_word_count_];
 
-    void* raw = operator new[](sizeof(detail::work_queue_t) * cpu_count_);
+    COOP_LOG("Spawning coop scheduler with %i threads\n", worker_count_);
+
+    void* raw = operator new[](sizeof(detail::work_queue_t) * worker_count_);
     queues_   = static_cast<detail::work_queue_t*>(raw);
 
-    for (decltype(cpu_count_) i = 0; i != cpu_count_; ++i)
+    for (decltype(worker_count_) i = 0; i != worker_count_; ++i)
     {
-        new (queues_ + i) detail::work_queue_t(*this, i);
+        uint32_t cpu = worker_cpus_[i];
+        cpu_mask_t pin_mask;
+        if (config.pinning == pinning_e::hard)
+        {
+            pin_mask.set(cpu);
+        }
+        else if (config.pinning == pinning_e::soft)
+        {
+            pin_mask = topology_.cache_mask(cpu) & cpu_mask_;
+        }
+
+        new (queues_ + i) detail::work_queue_t(
+            *this, i, cpu, std::move(pin_mask), config.queue_capacity);
     }
 
+    // A high quality PRNG number isn't needed here, as this update counter is
+    // used to drive a low discrepancy sequence
+    update_ = std::rand();
+
+    // Set before spawning any thread so that destroying the scheduler
+    // immediately after constructing it can't race with the thread's startup
+    active_ = true;
+
+#if defined(_WIN32)
     // Initialize room for 32 events
     event_capacity_      = 32;
     event_count_         = 1;
@@ -42,13 +214,7 @@ scheduler_t::scheduler_t()
     event_thread_signal_.init(false, "coop_main_event");
     events_[0] = event_thread_signal_;
 
-    // A high quality PRNG number isn't needed here, as this update counter is
-    // used to drive a low discrepancy sequence
-    update_ = std::rand();
-
-#ifdef _WIN32
     event_thread_ = std::thread([this] {
-        active_ = true;
         while (active_)
         {
             auto [status, index] = event_t::wait_many(events_, event_count_);
@@ -78,7 +244,8 @@ scheduler_t::scheduler_t()
                 {
                     event_capacity_     = size + event_count_ * 2;
                     event_ref_t* events = new event_ref_t[event_capacity_];
-                    std::memcpy(events_, events, sizeof(event_t) * event_count_);
+                    std::memcpy(
+                        events, events_, sizeof(event_ref_t) * event_count_);
                     delete[] events_;
                     events_ = events;
 
@@ -110,6 +277,13 @@ scheduler_t::scheduler_t()
                 COOP_LOG(
                     "Added %zu events to the event processing thread\n", size);
                 event_count_ += size;
+
+                // The signal was consumed, so signal again if requests were
+                // left behind (e.g. if more arrived than there was room for)
+                if (pending_events_.size_approx() != 0)
+                {
+                    events_[0].signal();
+                }
             }
             else
             {
@@ -118,18 +292,16 @@ scheduler_t::scheduler_t()
 
                 // An event has been signaled. Enqueue its associated
                 // continuation.
-                event_continuation_t& continuation
-                    = event_continuations_[index - 1];
-                schedule(continuation.coroutine,
-                         continuation.cpu_affinity,
-                         continuation.priority);
+                detail::event_waiter_t* waiter
+                    = event_continuations_[index - 1].waiter;
+                waiter->wake(*waiter);
 
                 // NOTE: if this event was the only event in the queue (aside
                 // from the thread signaler), these swaps are in-place swaps and
                 // thus no-ops
                 std::swap(events_[index], events_[event_count_ - 1]);
                 std::swap(event_continuations_[index - 1],
-                          event_continuations_[event_count_ - 1]);
+                          event_continuations_[event_count_ - 2]);
                 --event_count_;
             }
         }
@@ -140,64 +312,266 @@ scheduler_t::scheduler_t()
 scheduler_t::~scheduler_t() noexcept
 {
     active_ = false;
-#ifdef _WIN32
+
+    // Stop all workers prior to destroying any of them since workers may steal
+    // from each other
+    for (decltype(worker_count_) i = 0; i != worker_count_; ++i)
+    {
+        queues_[i].stop();
+    }
+
+#if defined(_WIN32)
     events_[0].signal();
     event_thread_.join();
-#endif
     delete[] events_;
     delete[] event_continuations_;
+#elif defined(__linux__)
+    // The reactor schedules coroutines onto the queues destroyed below
+    reactor_.stop();
+#endif
 
-    for (decltype(cpu_count_) i = 0; i != cpu_count_; ++i)
+    for (decltype(worker_count_) i = 0; i != worker_count_; ++i)
     {
         queues_[i].~work_queue_t();
     }
     operator delete[](static_cast<void*>(queues_));
+    delete[] idle_;
+    delete[] worker_cpus_;
+    delete[] cpu_workers_;
+    delete[] priority_weights_;
 }
 
 void scheduler_t::schedule(std::coroutine_handle<> coroutine,
-                           uint64_t cpu_affinity,
+                           cpu_mask_t cpu_affinity,
                            uint32_t priority,
                            source_location_t source_location)
 {
-    if (cpu_affinity == 0)
+    // Bits corresponding to CPUs that don't exist are ignored, and an empty
+    // mask permits any CPU
+    normalize(cpu_affinity);
+
+    // Worker threads push unconstrained coroutines to their own deque. This
+    // avoids a trip through a multi-producer queue for coroutines spawned
+    // from within other coroutines. A parked peer (if any, and preferably a
+    // nearby one) is woken so that it can steal from us.
+    uint32_t cpu = origin();
+    if (cpu_affinity.empty() && cpu != cpu_mask_t::npos)
+    {
+        detail::work_queue_t& local = queues_[cpu_workers_[cpu]];
+        if (local.push_local(coroutine, priority, source_location))
+        {
+            uint32_t queue;
+            if (claim_nearby_idle(cpu_mask_, queue, cpu, cpu))
+            {
+                COOP_LOG("Waking work queue %i to steal from %i\n",
+                         queue,
+                         local.id());
+                queues_[queue].notify();
+            }
+            return;
+        }
+    }
+
+    uint32_t queue = select(cpu_affinity, cpu);
+    queues_[queue].enqueue(
+        coroutine, std::move(cpu_affinity), priority, source_location);
+}
+
+void scheduler_t::schedule(std::coroutine_handle<> coroutine,
+                           deadline_t deadline,
+                           cpu_mask_t cpu_affinity,
+                           source_location_t source_location)
+{
+    // Coroutines with deadlines always go through a worker's deadline queue,
+    // even when scheduled by a worker onto itself, as only that queue is
+    // ordered by deadline
+    normalize(cpu_affinity);
+    uint32_t queue = select(cpu_affinity, origin());
+    queues_[queue].enqueue(
+        coroutine, deadline, std::move(cpu_affinity), source_location);
+}
+
+bool scheduler_t::try_run_one()
+{
+    // Workers start with their own queue. Other threads have no CPU, so only
+    // coroutines that may run anywhere are handed to them.
+    uint32_t cpu   = origin();
+    uint32_t start = cpu == cpu_mask_t::npos ? 0 : cpu_workers_[cpu];
+
+    std::coroutine_handle<> coroutine;
+    for (uint32_t i = 0; i != worker_count_; ++i)
+    {
+        detail::work_queue_t& victim = queues_[(start + i) % worker_count_];
+        if (victim.size_approx() != 0 && victim.try_steal(cpu, coroutine))
+        {
+            COOP_LOG("Coroutine %p run by helping thread %zu\n",
+                     coroutine.address(),
+                     detail::thread_id());
+            coroutine.resume();
+            return true;
+        }
+    }
+    return false;
+}
+
+void scheduler_t::normalize(cpu_mask_t& cpu_affinity) const noexcept
+{
+    cpu_affinity &= cpu_mask_;
+    if (cpu_affinity == cpu_mask_)
+    {
+        cpu_affinity = {};
+    }
+}
+
+uint32_t scheduler_t::select(cpu_mask_t const& cpu_affinity,
+                             uint32_t origin) noexcept
+{
+    cpu_mask_t const& permitted
+        = cpu_affinity.empty() ? cpu_mask_ : cpu_affinity;
+
+    uint32_t queue;
+    if (claim_nearby_idle(permitted, queue, cpu_mask_t::npos, origin))
+    {
+        COOP_LOG("Idle work queue %i identified\n", queue);
+    }
+    else
+    {
+        queue = select_busy(permitted, origin);
+        COOP_LOG("Work queue %i identified\n", queue);
+    }
+    return queue;
+}
+
+uint32_t scheduler_t::origin() const noexcept
+{
+    detail::work_queue_t* local = detail::work_queue_t::current();
+    if (local && &local->scheduler() == this)
     {
-        cpu_affinity = ~cpu_affinity & cpu_mask_;
+        return local->cpu();
     }
+    return cpu_mask_t::npos;
+}
 
-    for (uint32_t i = 0; i != cpu_count_; ++i)
+bool scheduler_t::claim_idle(cpu_mask_t const& cpu_affinity,
+                             uint32_t& queue,
+                             uint32_t exclude,
+                             cpu_mask_t const* locality) noexcept
+{
+    // On machines with 64 or fewer hardware threads, this visits one word
+    uint32_t words = std::min(idle_word_count_, cpu_affinity.word_count());
+    for (uint32_t i = 0; i != words; ++i)
     {
-        if (cpu_affinity & (1ull << i))
+        uint64_t candidates = idle_[i].bits.load(std::memory_order_relaxed)
+                              & cpu_affinity.word(i);
+        if (locality)
+        {
+            candidates &= locality->word(i);
+        }
+        if (exclude / 64 == i)
+        {
+            candidates &= ~(1ull << (exclude % 64));
+        }
+
+        while (candidates != 0)
         {
-            if (queues_[i].size_approx() == 0)
+            uint32_t index = std::countr_zero(candidates);
+            uint64_t bit   = 1ull << index;
+
+            // Clearing the bit claims the worker. If another thread got there
+            // first, move on to the next candidate.
+            if (idle_[i].bits.fetch_and(~bit, std::memory_order_acquire) & bit)
             {
-                COOP_LOG("Empty work queue %i identified\n", i);
-                queues_[i].enqueue(coroutine, priority, source_location);
-                return;
+                queue = cpu_workers_[i * 64 + index];
+                return true;
             }
+            candidates &= ~bit;
+        }
+    }
+    return false;
+}
+
+bool scheduler_t::claim_nearby_idle(cpu_mask_t const& cpu_affinity,
+                                    uint32_t& queue,
+                                    uint32_t exclude,
+                                    uint32_t origin) noexcept
+{
+    if (origin != cpu_mask_t::npos)
+    {
+        if (claim_idle(
+                cpu_affinity, queue, exclude, &topology_.cache_mask(origin)))
+        {
+            return true;
+        }
+
+        if (topology_.node_count() > 1
+            && claim_idle(
+                cpu_affinity, queue, exclude, &topology_.node_mask(origin)))
+        {
+            return true;
         }
     }
 
-    // All queues appear to be busy, pick a random one with reasonably low
-    // discrepancy (Kronecker recurrence sequence)
-    uint32_t index = static_cast<uint32_t>(update_++ * std::numbers::phi_v<float>)
-                     % std::popcount(cpu_affinity);
+    return claim_idle(cpu_affinity, queue, exclude);
+}
 
-    // Iteratively unset bits to determine the nth set bit
-    for (uint32_t i = 0; i != index; ++i)
+uint32_t scheduler_t::select_busy(cpu_mask_t const& cpu_affinity,
+                                  uint32_t origin) noexcept
+{
+    cpu_mask_t const* locality = nullptr;
+    uint32_t count             = 0;
+    if (origin != cpu_mask_t::npos && topology_.node_count() > 1)
     {
-        cpu_affinity &= ~(1 << (std::countr_zero(cpu_affinity) + 1));
+        locality = &topology_.node_mask(origin);
+        for (uint32_t i = 0; i != cpu_affinity.word_count(); ++i)
+        {
+            count += std::popcount(cpu_affinity.word(i) & locality->word(i));
+        }
     }
-    uint32_t queue = std::countr_zero(cpu_affinity);
-    COOP_LOG("Work queue %i identified\n", queue);
 
-    queues_[queue].enqueue(coroutine, priority, source_location);
+    if (count == 0)
+    {
+        locality = nullptr;
+        count    = cpu_affinity.count();
+    }
+
+    // Pick a candidate with reasonably low discrepancy (a Weyl sequence driven
+    // by the golden ratio, mapped to the number of candidates with a
+    // fixed-point multiply)
+    uint32_t index = static_cast<uint32_t>(
+        (uint64_t{update_++ * 0x9e3779b9u} * count) >> 32);
+
+    for (uint32_t i = 0; i != cpu_affinity.word_count(); ++i)
+    {
+        uint64_t candidates = cpu_affinity.word(i);
+        if (locality)
+        {
+            candidates &= locality->word(i);
+        }
+
+        uint32_t popcount = std::popcount(candidates);
+        if (index < popcount)
+        {
+            // Iteratively unset the lowest bits to determine the nth set bit
+            for (; index != 0; --index)
+            {
+                candidates &= candidates - 1;
+            }
+            return cpu_workers_[i * 64 + std::countr_zero(candidates)];
+        }
+        index -= popcount;
+    }
+
+    // Unreachable as long as the affinity mask is non-empty
+    return 0;
 }
 
-void scheduler_t::schedule(std::coroutine_handle<> coroutine,
-                           event_ref_t event,
-                           uint64_t cpu_affinity,
-                           uint32_t priority)
+bool scheduler_t::schedule(detail::event_waiter_t& waiter, event_ref_t event)
 {
-    pending_events_.enqueue({coroutine, event, cpu_affinity, priority});
+#if defined(_WIN32)
+    pending_events_.enqueue({&waiter, event});
     events_[0].signal();
+    return true;
+#elif defined(__linux__)
+    return reactor_.wait(event.fd(), EPOLLIN, waiter);
+#endif
 }
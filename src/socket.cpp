@@ -0,0 +1,40 @@
+#include <coop/socket.hpp>
+
+#if defined(__linux__)
+
+#    include <cerrno>
+
+using namespace coop;
+using namespace coop::detail;
+
+ssize_t socket_op_t::attempt() const noexcept
+{
+    ssize_t result = 0;
+    switch (opcode)
+    {
+    case opcode_e::accept:
+        result = accept4(socket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        break;
+    case opcode_e::recv:
+        result = ::recv(socket, buffer, size, MSG_DONTWAIT);
+        break;
+    case opcode_e::send:
+        result = ::send(socket, buffer, size, MSG_DONTWAIT | MSG_NOSIGNAL);
+        break;
+    }
+
+    if (result >= 0)
+    {
+        return result;
+    }
+
+    // Interrupted calls are simply retried once the socket is ready
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+    {
+        return -EAGAIN;
+    }
+
+    return -errno;
+}
+
+#endif
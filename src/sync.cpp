@@ -0,0 +1,65 @@
+#include <coop/sync.hpp>
+
+using namespace coop;
+
+namespace
+{
+// Waiters may be destroyed as soon as they're resumed
+void wake_all(detail::waiter_t* waiter) noexcept
+{
+    while (waiter)
+    {
+        detail::waiter_t* next = waiter->next;
+        waiter->wake(*waiter);
+        waiter = next;
+    }
+}
+} // namespace
+
+void async_latch_t::count_down(int64_t count) noexcept
+{
+    int64_t previous = count_.fetch_sub(count, std::memory_order_acq_rel);
+    if (previous > 0 && previous <= count)
+    {
+        uintptr_t waiters = waiters_.exchange(released, std::memory_order_acq_rel);
+        wake_all(reinterpret_cast<detail::waiter_t*>(waiters));
+    }
+}
+
+bool async_latch_t::wait_or_release(detail::waiter_t& waiter) noexcept
+{
+    uintptr_t waiters = waiters_.load(std::memory_order_acquire);
+    while (waiters != released)
+    {
+        waiter.next = reinterpret_cast<detail::waiter_t*>(waiters);
+        if (waiters_.compare_exchange_weak(waiters,
+                                           reinterpret_cast<uintptr_t>(&waiter),
+                                           std::memory_order_acq_rel,
+                                           std::memory_order_acquire))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool async_barrier_t::arrive_or_wait(detail::waiter_t& waiter) noexcept
+{
+    detail::waiter_t* waiters;
+    {
+        std::lock_guard lock{mutex_};
+        if (--remaining_ != 0)
+        {
+            waiter.next = waiters_;
+            waiters_    = &waiter;
+            return true;
+        }
+
+        // Complete the phase and reset for the next one
+        waiters    = waiters_;
+        waiters_   = nullptr;
+        remaining_ = count_;
+    }
+    wake_all(waiters);
+    return false;
+}
@@ -0,0 +1,270 @@
+#include <coop/timer.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <coop/detail/tracer.hpp>
+
+using namespace coop;
+using namespace coop::detail;
+
+timer_service_t& timer_service_t::instance() noexcept
+{
+    static timer_service_t timer_service;
+    return timer_service;
+}
+
+timer_service_t::timer_service_t(std::chrono::nanoseconds tick)
+    : epoch_{std::chrono::steady_clock::now()}
+    , tick_{std::max(tick, std::chrono::nanoseconds{1})}
+{
+    thread_ = std::thread([this] {
+        std::unique_lock lock{mutex_};
+        while (active_)
+        {
+            // Sleep until the next tick with anything to do, or indefinitely
+            // if no timers are pending. Adding a timer that expires sooner
+            // wakes the thread early.
+            wake_tick_ = next_tick();
+            if (wake_tick_ == UINT64_MAX)
+            {
+                cv_.wait(lock);
+            }
+            else
+            {
+                cv_.wait_until(lock, epoch_ + tick_ * wake_tick_);
+            }
+            wake_tick_ = 0;
+
+            // Process every tick that has elapsed. Ticks without an occupied
+            // slot are skipped, as processing them has no effect.
+            uint64_t target
+                = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now() - epoch_)
+                  / tick_;
+            while (now_ < target)
+            {
+                uint64_t next = next_tick();
+                if (next > target)
+                {
+                    now_ = target;
+                    break;
+                }
+                now_ = next - 1;
+                advance();
+            }
+
+            // Expire timers without holding the lock, as resuming them
+            // reenters the timer service if they sleep again. Expired timers
+            // stay cancellable until their callback starts, and cancelling
+            // a timer whose callback is running waits for it to return.
+            while (expired_)
+            {
+                timer_node_t* node = expired_;
+                unlink(node);
+                --size_;
+                running_ = node;
+                lock.unlock();
+
+                // The callback may destroy the node
+                node->expire(node);
+
+                lock.lock();
+                running_ = nullptr;
+                expiry_cv_.notify_all();
+            }
+        }
+    });
+}
+
+timer_service_t::~timer_service_t() noexcept
+{
+    {
+        std::lock_guard lock{mutex_};
+        active_ = false;
+    }
+    cv_.notify_one();
+    thread_.join();
+}
+
+void timer_service_t::add(timer_node_t* node, deadline_t deadline)
+{
+    assert(node->expire && "Timer nodes require an expiration callback");
+
+    bool wake;
+    {
+        std::lock_guard lock{mutex_};
+
+        if (size_ == 0)
+        {
+            // The wheel doesn't advance while it's empty, so skip ahead to
+            // the current tick rather than having the thread catch up
+            auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - epoch_);
+            now_ = std::max<uint64_t>(now_, elapsed / tick_);
+        }
+
+        // Round up so that timers never expire early. The current tick's
+        // slot has already been processed, so the earliest a timer can
+        // expire is the next tick.
+        auto elapsed = std::max(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - epoch_),
+            std::chrono::nanoseconds::zero());
+        uint64_t tick = (elapsed + tick_ - std::chrono::nanoseconds{1}) / tick_;
+        node->expiry_tick = std::max(tick, now_ + 1);
+        place(node);
+        ++size_;
+
+        // Otherwise, the thread will wake in time (or is already awake)
+        wake = node->expiry_tick < wake_tick_;
+    }
+
+    if (wake)
+    {
+        cv_.notify_one();
+    }
+}
+
+bool timer_service_t::cancel(timer_node_t* node) noexcept
+{
+    std::unique_lock lock{mutex_};
+    if (node->slot)
+    {
+        unlink(node);
+        --size_;
+        return true;
+    }
+
+    // The callback may be the caller (e.g. if it resumes a coroutine inline
+    // which then destroys the node), in which case it can't be waited for
+    if (std::this_thread::get_id() != thread_.get_id())
+    {
+        expiry_cv_.wait(lock, [this, node] { return running_ != node; });
+    }
+    return false;
+}
+
+size_t timer_service_t::size() const noexcept
+{
+    std::lock_guard lock{mutex_};
+    return size_;
+}
+
+void timer_service_t::place(timer_node_t* node) noexcept
+{
+    // Timers beyond the range of the wheel are parked in the outermost level
+    // at the furthest placement possible and re-placed when their slot is
+    // cascaded
+    constexpr uint64_t range = 1ull << (slot_bits * level_count);
+    uint64_t delta           = node->expiry_tick - now_;
+    uint64_t expiry = delta < range ? node->expiry_tick : now_ + range - 1;
+    delta           = expiry - now_;
+
+    uint32_t level = 0;
+    while (level != level_count - 1 && delta >= 1ull << (slot_bits * (level + 1)))
+    {
+        ++level;
+    }
+
+    timer_node_t*& head
+        = slots_[level][(expiry >> (slot_bits * level)) & (slot_count - 1)];
+    node->slot = &head;
+    node->prev = nullptr;
+    node->next = head;
+    if (head)
+    {
+        head->prev = node;
+    }
+    head = node;
+}
+
+void timer_service_t::unlink(timer_node_t* node) noexcept
+{
+    if (node->prev)
+    {
+        node->prev->next = node->next;
+    }
+    else
+    {
+        *node->slot = node->next;
+    }
+
+    if (node->next)
+    {
+        node->next->prev = node->prev;
+    }
+
+    node->slot = nullptr;
+    node->next = nullptr;
+    node->prev = nullptr;
+}
+
+void timer_service_t::advance() noexcept
+{
+    ++now_;
+
+    // When the slot index of a level wraps around, the next slot of the level
+    // above comes into range and its timers are redistributed to lower levels
+    for (uint32_t level = 1; level != level_count; ++level)
+    {
+        if (((now_ >> (slot_bits * (level - 1))) & (slot_count - 1)) != 0)
+        {
+            break;
+        }
+
+        timer_node_t*& head
+            = slots_[level][(now_ >> (slot_bits * level)) & (slot_count - 1)];
+        timer_node_t* node = head;
+        head               = nullptr;
+        while (node)
+        {
+            timer_node_t* next = node->next;
+            place(node);
+            node = next;
+        }
+    }
+
+    // Expired timers are moved to a list of their own, where they can still
+    // be cancelled until their callbacks run
+    timer_node_t*& head = slots_[0][now_ & (slot_count - 1)];
+    while (head)
+    {
+        timer_node_t* node = head;
+        unlink(node);
+        node->slot = &expired_;
+        node->next = expired_;
+        if (expired_)
+        {
+            expired_->prev = node;
+        }
+        expired_ = node;
+    }
+}
+
+uint64_t timer_service_t::next_tick() const noexcept
+{
+    if (size_ == 0)
+    {
+        return UINT64_MAX;
+    }
+
+    // The slots of level 0 are processed on consecutive ticks, while the
+    // slots of level L are cascaded on consecutive multiples of 64^L ticks.
+    // Each slot is processed once per rotation of its level, so the first
+    // occupied slot of each level in rotation order determines when the
+    // level next has work.
+    uint64_t out = UINT64_MAX;
+    for (uint32_t level = 0; level != level_count; ++level)
+    {
+        uint32_t shift = slot_bits * level;
+        for (uint64_t i = 1; i <= slot_count; ++i)
+        {
+            uint64_t tick = ((now_ >> shift) + i) << shift;
+            if (slots_[level][(tick >> shift) & (slot_count - 1)])
+            {
+                out = std::min(out, tick);
+                break;
+            }
+        }
+    }
+    return out;
+}
@@ -0,0 +1,313 @@
+#include <coop/topology.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <coop/detail/tracer.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <utility>
+
+#if defined(_WIN32)
+#    define WIN32_LEAN_AND_MEAN
+#    include <Windows.h>
+#elif defined(__linux__)
+#    include <cerrno>
+#    include <sched.h>
+#endif
+
+using namespace coop;
+
+namespace
+{
+#if defined(__linux__)
+// Reads the first line of a (sysfs) file, returning false if it doesn't exist
+bool read_line(char const* path, char* buffer, size_t size)
+{
+    std::FILE* file = std::fopen(path, "r");
+    if (!file)
+    {
+        return false;
+    }
+    bool result = std::fgets(buffer, static_cast<int>(size), file) != nullptr;
+    std::fclose(file);
+    return result;
+}
+#endif
+} // namespace
+
+topology_t topology_t::discover(uint32_t cpu_count)
+{
+    topology_t out;
+    out.cpus_.resize(cpu_count);
+
+    // Start from a flat topology in case discovery fails or isn't supported
+    cpu_mask_t all = cpu_mask_t::first(cpu_count);
+    for (uint32_t cpu = 0; cpu != cpu_count; ++cpu)
+    {
+        cpu_info_t& info = out.cpus_[cpu];
+        info.core        = cpu;
+        info.cache_mask  = all;
+        info.node_mask   = all;
+    }
+
+#if defined(__linux__)
+    // CPU lists can get long on machines with many CPUs
+    char buffer[4096];
+    char path[128];
+
+    if (read_line("/sys/devices/system/node/possible", buffer, sizeof(buffer)))
+    {
+        cpu_mask_t nodes    = cpu_mask_t::parse(buffer);
+        uint32_t node_count = 0;
+        for (uint32_t node = nodes.next(0); node != cpu_mask_t::npos;
+             node          = nodes.next(node + 1))
+        {
+            snprintf(path,
+                     sizeof(path),
+                     "/sys/devices/system/node/node%u/cpulist",
+                     node);
+            if (!read_line(path, buffer, sizeof(buffer)))
+            {
+                continue;
+            }
+
+            // Nodes without CPUs (e.g. memory-only nodes) are ignored
+            cpu_mask_t cpus = cpu_mask_t::parse(buffer) & all;
+            if (cpus.empty())
+            {
+                continue;
+            }
+
+            ++node_count;
+            for (uint32_t cpu = cpus.next(0); cpu != cpu_mask_t::npos;
+                 cpu          = cpus.next(cpu + 1))
+            {
+                out.cpus_[cpu].node      = node;
+                out.cpus_[cpu].node_mask = cpus;
+            }
+        }
+        out.node_count_ = std::max(node_count, 1u);
+    }
+
+    for (uint32_t cpu = 0; cpu != cpu_count; ++cpu)
+    {
+        cpu_info_t& info = out.cpus_[cpu];
+
+        snprintf(path,
+                 sizeof(path),
+                 "/sys/devices/system/cpu/cpu%u/topology/thread_siblings_list",
+                 cpu);
+        if (read_line(path, buffer, sizeof(buffer)))
+        {
+            cpu_mask_t siblings = cpu_mask_t::parse(buffer) & all;
+            if (!siblings.empty())
+            {
+                info.core = siblings.next(0);
+            }
+        }
+
+        // The last-level cache corresponds to the cache index with the
+        // highest level (typically the L3 cache, which is per-CCX on AMD
+        // parts)
+        uint32_t level = 0;
+        for (uint32_t index = 0;; ++index)
+        {
+            snprintf(path,
+                     sizeof(path),
+                     "/sys/devices/system/cpu/cpu%u/cache/index%u/level",
+                     cpu,
+                     index);
+            if (!read_line(path, buffer, sizeof(buffer)))
+            {
+                break;
+            }
+
+            uint32_t current = std::strtoul(buffer, nullptr, 10);
+            if (current < level)
+            {
+                continue;
+            }
+
+            snprintf(path,
+                     sizeof(path),
+                     "/sys/devices/system/cpu/cpu%u/cache/index%u/"
+                     "shared_cpu_list",
+                     cpu,
+                     index);
+            if (!read_line(path, buffer, sizeof(buffer)))
+            {
+                continue;
+            }
+
+            cpu_mask_t shared = cpu_mask_t::parse(buffer) & all;
+            if (!shared.empty())
+            {
+                level           = current;
+                info.cache      = shared.next(0);
+                info.cache_mask = std::move(shared);
+            }
+        }
+
+        COOP_LOG("CPU %u: core %u, cache %u, node %u\n",
+                 cpu,
+                 info.core,
+                 info.cache,
+                 info.node);
+    }
+#endif
+
+    return out;
+}
+
+cpu_mask_t topology_t::available_cpus()
+{
+#if defined(_WIN32)
+    DWORD_PTR process_mask = 0;
+    DWORD_PTR system_mask  = 0;
+    if (GetProcessAffinityMask(
+            GetCurrentProcess(), &process_mask, &system_mask)
+        && process_mask != 0)
+    {
+        return cpu_mask_t{static_cast<uint64_t>(process_mask)};
+    }
+#elif defined(__linux__)
+    // The kernel rejects sets smaller than its own CPU mask with EINVAL, so
+    // grow the set until it fits
+    for (uint32_t count = 1024; count <= (1u << 20); count *= 2)
+    {
+        cpu_set_t* cpuset = CPU_ALLOC(count);
+        size_t size       = CPU_ALLOC_SIZE(count);
+        CPU_ZERO_S(size, cpuset);
+        if (sched_getaffinity(0, size, cpuset) == 0)
+        {
+            cpu_mask_t out;
+            for (uint32_t cpu = 0; cpu != size * 8; ++cpu)
+            {
+                if (CPU_ISSET_S(cpu, size, cpuset))
+                {
+                    out.set(cpu);
+                }
+            }
+            CPU_FREE(cpuset);
+
+            if (!out.empty())
+            {
+                return out;
+            }
+            break;
+        }
+        CPU_FREE(cpuset);
+
+        if (errno != EINVAL)
+        {
+            break;
+        }
+    }
+#endif
+
+    return cpu_mask_t::first(std::max(std::thread::hardware_concurrency(), 1u));
+}
+
+uint32_t topology_t::parse_cpu_max(char const* line)
+{
+    // The file contains "<quota> <period>", with a quota of "max" if the
+    // cgroup is unlimited
+    if (!std::isdigit(static_cast<unsigned char>(*line)))
+    {
+        return 0;
+    }
+    char* end                = nullptr;
+    unsigned long long quota = std::strtoull(line, &end, 10);
+    if (*end != ' ')
+    {
+        return 0;
+    }
+    unsigned long long period = std::strtoull(end, nullptr, 10);
+    if (period == 0)
+    {
+        return 0;
+    }
+    unsigned long long cpus = std::max((quota + period - 1) / period, 1ull);
+    return static_cast<uint32_t>(std::min(cpus, 0xffffffffull));
+}
+
+uint32_t topology_t::cpu_quota()
+{
+    uint32_t out = 0;
+
+#if defined(__linux__)
+    char buffer[4096];
+    char group[4096];
+    size_t length = 0;
+
+    // The cgroup v2 hierarchy is listed in /proc/self/cgroup as "0::<path>".
+    // The path is relative to the cgroup namespace root, which is where the
+    // cgroup2 filesystem is mounted within a container.
+    std::FILE* file = std::fopen("/proc/self/cgroup", "r");
+    if (!file)
+    {
+        return 0;
+    }
+    while (std::fgets(buffer, sizeof(buffer), file))
+    {
+        if (std::strncmp(buffer, "0::/", 4) == 0)
+        {
+            length = std::strcspn(buffer + 3, "\n");
+            std::memcpy(group, buffer + 3, length);
+            break;
+        }
+    }
+    std::fclose(file);
+
+    if (length == 0)
+    {
+        // No cgroup v2 hierarchy
+        return 0;
+    }
+
+    // Limits of ancestor cgroups apply too, so walk up to the root and keep
+    // the tightest limit
+    char path[4096 + 32];
+    while (true)
+    {
+        snprintf(path,
+                 sizeof(path),
+                 "/sys/fs/cgroup%.*s/cpu.max",
+                 length > 1 ? static_cast<int>(length) : 0,
+                 group);
+
+        if (read_line(path, buffer, sizeof(buffer)))
+        {
+            uint32_t cpus = parse_cpu_max(buffer);
+            if (cpus != 0)
+            {
+                out = out == 0 ? cpus : std::min(out, cpus);
+            }
+        }
+
+        if (length <= 1)
+        {
+            break;
+        }
+
+        // Strip the last path component, leaving "/" for the root
+        while (group[length - 1] != '/')
+        {
+            --length;
+        }
+        if (length > 1)
+        {
+            --length;
+        }
+    }
+
+    if (out != 0)
+    {
+        COOP_LOG("cgroup CPU quota: %u CPUs\n", out);
+    }
+#endif
+
+    return out;
+}
@@ -3,7 +3,9 @@
 #include <algorithm>
 #include <cassert>
 #include <coop/detail/tracer.hpp>
+#include <coop/scheduler.hpp>
 #include <cstdio>
+#include <new>
 
 #ifdef _WIN32
 #    define WIN32_LEAN_AND_MEAN
@@ -16,87 +18,378 @@
 using namespace coop;
 using namespace coop::detail;
 
-work_queue_t::work_queue_t(scheduler_t& scheduler, uint32_t id)
+namespace
+{
+thread_local work_queue_t* current_queue = nullptr;
+
+// Binds the calling thread to the supplied CPUs, returning false on failure
+bool set_thread_affinity(cpu_mask_t const& cpus)
+{
+#if defined(_WIN32)
+    // Threads can only be bound to processors within a single processor group
+    // (of at most 64 processors)
+    uint32_t group = cpus.next(0) / 64;
+    GROUP_AFFINITY affinity{};
+    affinity.Group = static_cast<WORD>(group);
+    affinity.Mask  = static_cast<KAFFINITY>(cpus.word(group));
+    return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+#elif defined(__linux__)
+    // TODO: Android implementation
+    // The fixed-size cpu_set_t only covers CPU_SETSIZE CPUs, so allocate a
+    // set large enough for the mask
+    uint32_t count    = cpus.word_count() * 64;
+    cpu_set_t* cpuset = CPU_ALLOC(count);
+    size_t size       = CPU_ALLOC_SIZE(count);
+    CPU_ZERO_S(size, cpuset);
+    for (uint32_t cpu = cpus.next(0); cpu != cpu_mask_t::npos;
+         cpu          = cpus.next(cpu + 1))
+    {
+        CPU_SET_S(cpu, size, cpuset);
+    }
+    int result = pthread_setaffinity_np(pthread_self(), size, cpuset);
+    CPU_FREE(cpuset);
+
+    if (result != 0)
+    {
+        errno = result;
+        return false;
+    }
+    return true;
+#elif (__APPLE__)
+    // TODO: MacOS/iOS implementation
+    return false;
+#endif
+}
+} // namespace
+
+work_queue_t* work_queue_t::current() noexcept
+{
+    return current_queue;
+}
+
+work_queue_t::work_queue_t(scheduler_t& scheduler,
+                           uint32_t id,
+                           uint32_t cpu,
+                           cpu_mask_t pin_mask,
+                           size_t capacity)
     : scheduler_{scheduler}
     , id_{id}
+    , cpu_{cpu}
     , sem_{0}
+    , deadline_queue_{capacity}
+    , pinned_deadline_queue_{capacity}
 {
     snprintf(label_, sizeof(label_), "work_queue:%i", id);
+
+    priority_count_ = scheduler_.priority_count_;
+    void* raw = operator new[](sizeof(moodycamel::ConcurrentQueue<work_item_t>)
+                               * priority_count_);
+    queues_   = static_cast<moodycamel::ConcurrentQueue<work_item_t>*>(raw);
+    raw = operator new[](sizeof(moodycamel::ConcurrentQueue<work_item_t>)
+                         * priority_count_);
+    pinned_queues_ = static_cast<moodycamel::ConcurrentQueue<work_item_t>*>(raw);
+    // The deques keep their indices on separate cache lines, so their
+    // storage must honor their over-alignment
+    raw     = operator new[](sizeof(work_deque_t) * priority_count_,
+                             std::align_val_t{alignof(work_deque_t)});
+    deques_ = static_cast<work_deque_t*>(raw);
+    for (size_t i = 0; i != priority_count_; ++i)
+    {
+        new (queues_ + i) moodycamel::ConcurrentQueue<work_item_t>(capacity);
+        new (pinned_queues_ + i)
+            moodycamel::ConcurrentQueue<work_item_t>(capacity);
+        new (deques_ + i) work_deque_t(capacity);
+    }
+
+    credits_ = new uint32_t[priority_count_];
+    std::copy(scheduler_.priority_weights_,
+              scheduler_.priority_weights_ + priority_count_,
+              credits_);
+
     active_ = true;
-    thread_ = std::thread([this] {
-#if defined(_WIN32)
-        SetThreadAffinityMask(
-            GetCurrentThread(), static_cast<uint32_t>(1ull << id_));
-#elif defined(__linux__)
-        // TODO: Android implementation
-        pthread_t thread = pthread_self();
-        cpu_set_t cpuset;
-        CPU_ZERO(&cpuset);
-        CPU_SET(id_, &cpuset);
-        int result = pthread_setaffinity_np(thread, sizeof(cpuset), &cpuset);
-
-        if (result != 0)
+    thread_ = std::thread([this, pin_mask = std::move(pin_mask)] {
+        // A worker that fails to pin keeps running unpinned, as the
+        // coroutines routed to it would otherwise never run
+        if (!pin_mask.empty() && !set_thread_affinity(pin_mask))
         {
-            errno = result;
             perror("Failed to set thread affinity");
-            return;
         }
-#elif (__APPLE__)
-    // TODO: MacOS/iOS implementation
-#endif
+
+        current_queue = this;
 
         while (true)
         {
+            // Advertise that this worker is parked so the scheduler prefers
+            // it. The advertisement is only a hint: each enqueue releases the
+            // semaphore once, so spurious wakeups are possible (e.g. if the
+            // coroutine that prompted the release was stolen in the meantime)
+            // but a missed notification is not. Parking before anything else
+            // also ensures peers are fully constructed before we attempt to
+            // steal from them.
+            auto& idle        = scheduler_.idle_[cpu_ / 64].bits;
+            uint64_t idle_bit = 1ull << (cpu_ % 64);
+            idle.fetch_or(idle_bit, std::memory_order_release);
             sem_.acquire();
+            idle.fetch_and(~idle_bit, std::memory_order_relaxed);
             if (!active_)
             {
                 return;
             }
 
-            bool did_dequeue = false;
-
-            // Dequeue in a loop because the concurrent queue isn't sequentially
-            // consistent
-            while (!did_dequeue)
+            // Run coroutines until there's nothing left to do locally or on
+            // any peer
+            std::coroutine_handle<> coroutine;
+            while (active_
+                   && (try_dequeue(coroutine)
+                       || try_steal_from_peers(coroutine)))
             {
-                for (int i = COOP_PRIORITY_COUNT - 1; i >= 0; --i)
-                {
-                    std::coroutine_handle<> coroutine;
-                    if (queues_[i].try_dequeue(coroutine))
-                    {
-                        COOP_LOG("Dequeueing coroutine %p on thread %zu (%i)\n",
-                                 coroutine.address(),
-                                 detail::thread_id(),
-                                 id_);
-                        did_dequeue = true;
-                        coroutine.resume();
-                        break;
-                    }
-                }
+                coroutine.resume();
             }
-
-            // TODO: Implement some sort of work stealing here
         }
     });
 }
 
 work_queue_t::~work_queue_t() noexcept
 {
-    active_ = false;
-    sem_.release();
-    thread_.join();
+    stop();
+
+    for (size_t i = 0; i != priority_count_; ++i)
+    {
+        queues_[i].~ConcurrentQueue();
+        pinned_queues_[i].~ConcurrentQueue();
+        deques_[i].~work_deque_t();
+    }
+    operator delete[](static_cast<void*>(queues_));
+    operator delete[](static_cast<void*>(pinned_queues_));
+    operator delete[](static_cast<void*>(deques_),
+                      std::align_val_t{alignof(work_deque_t)});
+    delete[] credits_;
+}
+
+void work_queue_t::stop() noexcept
+{
+    if (thread_.joinable())
+    {
+        active_ = false;
+        sem_.release();
+        thread_.join();
+    }
+}
+
+bool work_queue_t::try_dequeue(std::coroutine_handle<>& coroutine)
+{
+    if (try_dequeue_deadline(coroutine))
+    {
+        return true;
+    }
+
+    // Levels are served as a weighted round robin. Draining higher priorities
+    // strictly first would let a steady stream of high priority coroutines
+    // starve lower priorities indefinitely.
+    for (int round = 0; round != 2; ++round)
+    {
+        bool exhausted = false;
+        for (int i = priority_count_ - 1; i >= 0; --i)
+        {
+            if (credits_[i] == 0)
+            {
+                exhausted = true;
+            }
+            else if (try_dequeue(i, coroutine))
+            {
+                --credits_[i];
+                return true;
+            }
+        }
+
+        if (!exhausted)
+        {
+            return false;
+        }
+
+        // Every level with credit remaining is empty, so start a new round in
+        // case the exhausted levels have work
+        std::copy(scheduler_.priority_weights_,
+                  scheduler_.priority_weights_ + priority_count_,
+                  credits_);
+    }
+    return false;
+}
+
+bool work_queue_t::try_dequeue(uint32_t priority,
+                               std::coroutine_handle<>& coroutine)
+{
+    if (deques_[priority].pop(coroutine))
+    {
+        COOP_LOG("Popping coroutine %p on thread %zu (%i)\n",
+                 coroutine.address(),
+                 detail::thread_id(),
+                 id_);
+        return true;
+    }
+
+    // Alternate between the level's queues so that neither starves the other
+    moodycamel::ConcurrentQueue<work_item_t>* first  = queues_ + priority;
+    moodycamel::ConcurrentQueue<work_item_t>* second = pinned_queues_ + priority;
+    if (pinned_first_)
+    {
+        std::swap(first, second);
+    }
+
+    work_item_t item;
+    if (first->try_dequeue(item) || second->try_dequeue(item))
+    {
+        pinned_first_ = !pinned_first_;
+        COOP_LOG("Dequeueing coroutine %p on thread %zu (%i)\n",
+                 item.coroutine.address(),
+                 detail::thread_id(),
+                 id_);
+        coroutine = item.coroutine;
+        return true;
+    }
+    return false;
+}
+
+bool work_queue_t::try_dequeue_deadline(std::coroutine_handle<>& coroutine)
+{
+    auto later = [](deadline_item_t const& lhs, deadline_item_t const& rhs) {
+        return lhs.deadline > rhs.deadline;
+    };
+
+    deadline_item_t item;
+    while (deadline_queue_.try_dequeue(item)
+           || pinned_deadline_queue_.try_dequeue(item))
+    {
+        deadline_heap_.push_back(item);
+        std::push_heap(deadline_heap_.begin(), deadline_heap_.end(), later);
+    }
+
+    if (deadline_heap_.empty())
+    {
+        return false;
+    }
+
+    std::pop_heap(deadline_heap_.begin(), deadline_heap_.end(), later);
+    coroutine = deadline_heap_.back().coroutine;
+    deadline_heap_.pop_back();
+    COOP_LOG("Dequeueing deadline coroutine %p on thread %zu (%i)\n",
+             coroutine.address(),
+             detail::thread_id(),
+             id_);
+    return true;
+}
+
+bool work_queue_t::try_steal([[maybe_unused]] uint32_t thief,
+                             std::coroutine_handle<>& coroutine)
+{
+    // Only unconstrained coroutines are stealable, so anything dequeued here
+    // may be kept by the thief
+    deadline_item_t deadline_item;
+    if (deadline_queue_.try_dequeue(deadline_item))
+    {
+        COOP_LOG("Deadline coroutine %p stolen from queue %i by queue %i\n",
+                 deadline_item.coroutine.address(),
+                 id_,
+                 thief);
+        coroutine = deadline_item.coroutine;
+        return true;
+    }
+
+    for (int i = priority_count_ - 1; i >= 0; --i)
+    {
+        // Coroutines in the deque aren't constrained by affinity
+        if (deques_[i].steal(coroutine))
+        {
+            COOP_LOG("Coroutine %p stolen from deque %i by queue %i\n",
+                     coroutine.address(),
+                     id_,
+                     thief);
+            return true;
+        }
+
+        work_item_t item;
+        if (queues_[i].try_dequeue(item))
+        {
+            COOP_LOG("Coroutine %p stolen from queue %i by queue %i\n",
+                     item.coroutine.address(),
+                     id_,
+                     thief);
+            coroutine = item.coroutine;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool work_queue_t::try_steal_from_peers(std::coroutine_handle<>& coroutine)
+{
+    // Visit SMT siblings first, followed by peers sharing our last-level
+    // cache, then peers on our NUMA node, and finally everyone else. Within
+    // each tier, peers are visited starting from the adjacent one.
+    topology_t const& topology = scheduler_.topology_;
+    uint32_t count             = scheduler_.worker_count_;
+    for (uint32_t tier = 0; tier <= uint32_t(topology_t::distance_e::remote);
+         ++tier)
+    {
+        for (uint32_t i = 1; i != count; ++i)
+        {
+            work_queue_t& victim = scheduler_.queues_[(id_ + i) % count];
+            if (uint32_t(topology.distance(cpu_, victim.cpu_)) != tier)
+            {
+                continue;
+            }
+
+            if (victim.size_approx() != 0 && victim.try_steal(cpu_, coroutine))
+            {
+                return true;
+            }
+        }
+    }
+    return false;
 }
 
 void work_queue_t::enqueue(std::coroutine_handle<> coroutine,
+                           cpu_mask_t cpu_affinity,
                            uint32_t priority,
-                           source_location_t source_location)
+                           [[maybe_unused]] source_location_t source_location)
 {
-    priority = std::clamp<uint32_t>(priority, 0, COOP_PRIORITY_COUNT - 1);
+    priority = std::min(priority, priority_count_ - 1);
     COOP_LOG("Enqueueing coroutine %p on thread %zu (%s:%zu)\n",
              coroutine.address(),
              detail::thread_id(),
              source_location.file,
              source_location.line);
-    queues_[priority].enqueue(coroutine);
+    auto* queues = cpu_affinity.empty() ? queues_ : pinned_queues_;
+    queues[priority].enqueue({coroutine});
     sem_.release();
 }
+
+void work_queue_t::enqueue(std::coroutine_handle<> coroutine,
+                           deadline_t deadline,
+                           cpu_mask_t cpu_affinity,
+                           [[maybe_unused]] source_location_t source_location)
+{
+    COOP_LOG("Enqueueing deadline coroutine %p on thread %zu (%s:%zu)\n",
+             coroutine.address(),
+             detail::thread_id(),
+             source_location.file,
+             source_location.line);
+    auto& queue
+        = cpu_affinity.empty() ? deadline_queue_ : pinned_deadline_queue_;
+    queue.enqueue({coroutine, deadline});
+    sem_.release();
+}
+
+bool work_queue_t::push_local(
+    std::coroutine_handle<> coroutine,
+    uint32_t priority,
+    [[maybe_unused]] source_location_t source_location) noexcept
+{
+    priority = std::min(priority, priority_count_ - 1);
+    COOP_LOG("Pushing coroutine %p on thread %zu (%s:%zu)\n",
+             coroutine.address(),
+             detail::thread_id(),
+             source_location.file,
+             source_location.line);
+    return deques_[priority].push(coroutine);
+}
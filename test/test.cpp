@@ -1,9 +1,26 @@
 #define DOCTEST_CONFIG_IMPLEMENT
 #include <doctest/doctest.h>
 
+#include <algorithm>
 #include <chrono>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <coop/arena.hpp>
+#include <coop/channel.hpp>
+#include <coop/generator.hpp>
+#include <coop/io.hpp>
+#include <coop/lazy_task.hpp>
+#include <coop/mutex.hpp>
+#include <coop/socket.hpp>
+#include <coop/sync.hpp>
 #include <coop/task.hpp>
+#include <coop/timer.hpp>
+#include <coop/when.hpp>
 #include <thread>
+#include <vector>
 
 coop::task_t<void, true> suspend_time()
 {
@@ -118,7 +135,1238 @@ TEST_CASE("multiple in flight")
     CHECK(ms < 150);
 }
 
-#ifdef _WIN32
+coop::task_t<int> delayed_value(int value, int ms)
+{
+    COOP_SUSPEND();
+    std::this_thread::sleep_for(std::chrono::milliseconds{ms});
+    co_return value;
+}
+
+coop::task_t<void, true> await_all(int& sum, std::atomic<int>& resumes)
+{
+    auto a = delayed_value(1, 20);
+    auto b = delayed_value(2, 5);
+    auto c = delayed_value(3, 0);
+    co_await coop::when_all(a, b, c);
+    ++resumes;
+    sum = *a + *b + co_await c;
+
+    std::vector<coop::task_t<int>> tasks;
+    for (int i = 0; i != 64; ++i)
+    {
+        tasks.push_back(delayed_value(i, i % 4));
+    }
+    co_await coop::when_all(tasks);
+    ++resumes;
+    for (auto& task : tasks)
+    {
+        sum += *task;
+    }
+
+    // Every task has completed, so this shouldn't suspend
+    co_await coop::when_all(tasks);
+    ++resumes;
+}
+
+coop::task_t<int> gated_value(int value, coop::event_t& gate)
+{
+    co_await gate;
+    co_return value;
+}
+
+coop::task_t<void, true> await_any(size_t& first, size_t& ready, int& sum)
+{
+    // The slow task can't complete until the fast one has won, regardless of
+    // timing or the number of workers
+    coop::event_t gate;
+    gate.init();
+    auto slow = gated_value(1, gate);
+    auto fast = delayed_value(2, 0);
+    first     = co_await coop::when_any(slow, fast);
+    gate.signal();
+
+    // The slow task can still be awaited normally
+    sum = co_await slow + co_await fast;
+    ready = co_await coop::when_any(slow, fast);
+
+    // Race completions against registration and withdrawal
+    for (int i = 0; i != 200; ++i)
+    {
+        std::vector<coop::task_t<int>> tasks;
+        for (int j = 0; j != 8; ++j)
+        {
+            tasks.push_back(delayed_value(j, 0));
+        }
+        size_t index = co_await coop::when_any(tasks);
+        co_await coop::when_all(tasks);
+        if (index < tasks.size() && *tasks[index] == int(index))
+        {
+            sum += 1;
+        }
+    }
+}
+
+TEST_CASE("when all")
+{
+    int sum                   = 0;
+    std::atomic<int> resumes = 0;
+    await_all(sum, resumes).join();
+    CHECK(sum == 6 + 64 * 63 / 2);
+    CHECK(resumes == 3);
+}
+
+TEST_CASE("when any")
+{
+    size_t first = 2;
+    size_t ready = 2;
+    int sum      = 0;
+    await_any(first, ready, sum).join();
+    CHECK(first == 1);
+    CHECK(sum == 203);
+    CHECK(ready == 0);
+}
+
+coop::lazy_task_t<int> lazy_sum(int depth, int& started)
+{
+    ++started;
+    if (depth == 0)
+    {
+        co_return 0;
+    }
+    co_return depth + co_await lazy_sum(depth - 1, started);
+}
+
+coop::lazy_task_t<> lazy_suspend(std::thread::id& id)
+{
+    COOP_SUSPEND();
+    id = std::this_thread::get_id();
+}
+
+coop::task_t<void, true> await_lazy(int& sum, int& started, bool& deferred, std::thread::id& id)
+{
+    COOP_SUSPEND();
+    auto task = lazy_sum(1000, started);
+    deferred  = started == 0;
+    sum       = co_await task;
+
+    // Lazy tasks may suspend onto other threads like any other coroutine
+    co_await lazy_suspend(id);
+}
+
+TEST_CASE("lazy task")
+{
+    int sum       = 0;
+    int started   = 0;
+    bool deferred = false;
+    std::thread::id id;
+    await_lazy(sum, started, deferred, id).join();
+    CHECK(deferred);
+    CHECK(started == 1001);
+    CHECK(sum == 1000 * 1001 / 2);
+    CHECK(id != std::thread::id{});
+
+    // A lazy task that's never awaited never runs
+    started = 0;
+    {
+        auto task = lazy_sum(10, started);
+    }
+    CHECK(started == 0);
+}
+
+struct record_t
+{
+    int value;
+
+    explicit record_t(int value)
+        : value{value}
+    {
+    }
+    record_t(record_t const&) = delete;
+    record_t& operator=(record_t const&) = delete;
+};
+
+coop::async_generator_t<record_t> produce_records(int count, int& produced)
+{
+    for (int i = 0; i != count; ++i)
+    {
+        // The producer may hop threads between values
+        if (i % 100 == 0)
+        {
+            COOP_SUSPEND();
+        }
+        record_t record{i};
+        ++produced;
+        co_yield record;
+    }
+}
+
+coop::async_generator_t<int> produce_nothing()
+{
+    co_return;
+}
+
+coop::task_t<void, true> consume_records(int& sum, int& produced, bool& in_step, bool& empty)
+{
+    auto records = produce_records(1000, produced);
+    while (record_t* record = co_await records.next())
+    {
+        // The producer never runs ahead of the consumer
+        if (produced != record->value + 1)
+        {
+            in_step = false;
+        }
+        sum += record->value;
+        if (record->value % 50 == 0)
+        {
+            COOP_SUSPEND();
+        }
+    }
+
+    auto nothing = produce_nothing();
+    empty        = co_await nothing.next() == nullptr;
+}
+
+TEST_CASE("async generator")
+{
+    int sum      = 0;
+    int produced = 0;
+    bool in_step  = true;
+    bool empty   = false;
+    consume_records(sum, produced, in_step, empty).join();
+    CHECK(sum == 1000 * 999 / 2);
+    CHECK(produced == 1000);
+    CHECK(in_step);
+    CHECK(empty);
+}
+
+coop::task_t<void, true> channel_producer(coop::channel_t<int>& channel,
+                                          int first,
+                                          int count,
+                                          std::atomic<int>& remaining)
+{
+    COOP_SUSPEND();
+    for (int i = first; i != first + count; ++i)
+    {
+        co_await channel.send(i);
+    }
+    --remaining;
+}
+
+coop::task_t<void, true> channel_consumer(coop::channel_t<int>& channel,
+                                          int count,
+                                          std::atomic<int64_t>& sum,
+                                          std::atomic<int>& remaining)
+{
+    COOP_SUSPEND();
+    int64_t local = 0;
+    for (int i = 0; i != count; ++i)
+    {
+        local += co_await channel.recv();
+    }
+    sum += local;
+    --remaining;
+}
+
+TEST_CASE("channel")
+{
+    // A small capacity forces both senders and receivers to suspend
+    constexpr int workers = 4;
+    constexpr int count   = 10000;
+    coop::channel_t<int> channel{4};
+    std::atomic<int64_t> sum  = 0;
+    std::atomic<int> remaining = 2 * workers;
+    for (int i = 0; i != workers; ++i)
+    {
+        channel_producer(channel, i * count, count, remaining);
+        channel_consumer(channel, count, sum, remaining);
+    }
+    while (remaining != 0)
+    {
+        std::this_thread::yield();
+    }
+    int64_t total = int64_t(workers) * count;
+    CHECK(sum == total * (total - 1) / 2);
+
+    int value = 0;
+    CHECK(!channel.try_recv(value));
+    for (int i = 0; i != 4; ++i)
+    {
+        CHECK(channel.try_send(i));
+    }
+    CHECK(!channel.try_send(4));
+    CHECK(channel.try_recv(value));
+    CHECK(value == 0);
+}
+
+// Neither default-constructible nor copyable
+struct channel_payload_t
+{
+    explicit channel_payload_t(int value)
+        : value{std::make_unique<int>(value)}
+    {
+    }
+
+    std::unique_ptr<int> value;
+};
+
+coop::task_t<void, true>
+channel_relay(coop::channel_t<channel_payload_t>& channel, int& sum)
+{
+    COOP_SUSPEND();
+    for (int i = 0; i != 100; ++i)
+    {
+        co_await channel.send(channel_payload_t{i});
+        channel_payload_t payload = co_await channel.recv();
+        sum += *payload.value;
+    }
+}
+
+TEST_CASE("channel payloads")
+{
+    coop::channel_t<channel_payload_t> channel{1};
+    int sum = 0;
+    channel_relay(channel, sum).join();
+    CHECK(sum == 99 * 100 / 2);
+
+    channel_payload_t payload{7};
+    CHECK(channel.try_send(std::move(payload)));
+    CHECK(!channel.try_send(channel_payload_t{8}));
+    std::optional<channel_payload_t> received = channel.try_recv();
+    REQUIRE(received);
+    CHECK(*received->value == 7);
+    CHECK(!channel.try_recv());
+}
+
+coop::task_t<void, true> contend_mutex(coop::async_mutex_t& mutex,
+                                       int& counter,
+                                       int iterations,
+                                       std::atomic<int>& remaining)
+{
+    COOP_SUSPEND();
+    for (int i = 0; i != iterations; ++i)
+    {
+        if (i % 2 == 0)
+        {
+            co_await mutex.lock();
+            ++counter;
+            mutex.unlock(i % 4 == 0 ? coop::handoff_e::immediate
+                                    : coop::handoff_e::schedule);
+        }
+        else
+        {
+            auto guard = co_await mutex.scoped_lock();
+            ++counter;
+        }
+    }
+    --remaining;
+}
+
+coop::task_t<> queue_on_mutex(coop::async_mutex_t& mutex, std::vector<int>& order, int id)
+{
+    co_await mutex.lock();
+    order.push_back(id);
+    mutex.unlock(coop::handoff_e::immediate);
+}
+
+coop::task_t<void, true> mutex_order(coop::async_mutex_t& mutex, std::vector<int>& order)
+{
+    co_await mutex.lock();
+    // Tasks start eagerly, so each queues on the mutex before the next starts
+    auto a = queue_on_mutex(mutex, order, 0);
+    auto b = queue_on_mutex(mutex, order, 1);
+    auto c = queue_on_mutex(mutex, order, 2);
+    mutex.unlock(coop::handoff_e::immediate);
+    co_await coop::when_all(a, b, c);
+}
+
+TEST_CASE("async mutex")
+{
+    coop::async_mutex_t mutex;
+    int counter                = 0;
+    constexpr int tasks        = 8;
+    constexpr int iterations   = 2000;
+    std::atomic<int> remaining = tasks;
+    for (int i = 0; i != tasks; ++i)
+    {
+        contend_mutex(mutex, counter, iterations, remaining);
+    }
+    while (remaining != 0)
+    {
+        std::this_thread::yield();
+    }
+    CHECK(counter == tasks * iterations);
+    CHECK(mutex.try_lock());
+    mutex.unlock();
+
+    // Waiters acquire the mutex in the order they arrived
+    std::vector<int> order;
+    mutex_order(mutex, order).join();
+    CHECK(order == std::vector<int>{0, 1, 2});
+}
+
+coop::task_t<void, true> limited_work(coop::async_semaphore_t& semaphore,
+                                      std::atomic<int>& active,
+                                      std::atomic<int>& peak,
+                                      coop::async_latch_t& latch)
+{
+    COOP_SUSPEND();
+    co_await semaphore.acquire();
+    int now = ++active;
+    int seen = peak.load();
+    while (now > seen && !peak.compare_exchange_weak(seen, now))
+    {
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds{200});
+    --active;
+    semaphore.release();
+    latch.count_down();
+}
+
+coop::task_t<void, true> await_latch(coop::async_latch_t& latch, bool& done)
+{
+    co_await latch.wait();
+    done = true;
+}
+
+TEST_CASE("async semaphore and latch")
+{
+    constexpr int count = 64;
+    coop::async_semaphore_t semaphore{3};
+    coop::async_latch_t latch{count};
+    std::atomic<int> active = 0;
+    std::atomic<int> peak   = 0;
+    bool done               = false;
+    auto waiter             = await_latch(latch, done);
+    for (int i = 0; i != count; ++i)
+    {
+        limited_work(semaphore, active, peak, latch);
+    }
+    waiter.join();
+    CHECK(done);
+    CHECK(latch.try_wait());
+    CHECK(peak <= 3);
+    CHECK(semaphore.count() == 3);
+
+    // Waiting on a released latch completes immediately
+    done = false;
+    await_latch(latch, done).join();
+    CHECK(done);
+}
+
+coop::task_t<void, true> simulate(coop::async_barrier_t& barrier,
+                                  std::atomic<int>* arrivals,
+                                  int phases,
+                                  std::atomic<bool>& in_phase,
+                                  std::atomic<int>& remaining)
+{
+    COOP_SUSPEND();
+    for (int phase = 0; phase != phases; ++phase)
+    {
+        ++arrivals[phase];
+        co_await barrier.arrive_and_wait();
+        // Every participant has arrived by the time any of them continues
+        if (arrivals[phase] != 4)
+        {
+            in_phase = false;
+        }
+    }
+    --remaining;
+}
+
+TEST_CASE("async barrier")
+{
+    constexpr int phases = 100;
+    coop::async_barrier_t barrier{4};
+    std::atomic<int> arrivals[phases] = {};
+    std::atomic<bool> in_phase        = true;
+    std::atomic<int> remaining        = 4;
+    for (int i = 0; i != 4; ++i)
+    {
+        simulate(barrier, arrivals, phases, in_phase, remaining);
+    }
+    while (remaining != 0)
+    {
+        std::this_thread::yield();
+    }
+    CHECK(in_phase);
+}
+
+TEST_CASE("cpu mask")
+{
+    coop::cpu_mask_t mask{0b1010};
+    mask.set(70).set(130);
+    CHECK(mask.test(1));
+    CHECK(!mask.test(2));
+    CHECK(mask.test(130));
+    CHECK(mask.count() == 4);
+    CHECK(mask.nth(2) == 70);
+    CHECK(mask.next(4) == 70);
+    CHECK(mask.next(131) == coop::cpu_mask_t::npos);
+
+    coop::cpu_mask_t copy = mask;
+    copy.reset(70);
+    CHECK(copy != mask);
+    CHECK((copy & coop::cpu_mask_t::first(100)) == coop::cpu_mask_t{0b1010});
+    CHECK((copy | mask) == mask);
+    CHECK(coop::cpu_mask_t::first(64).count() == 64);
+    CHECK(coop::cpu_mask_t{}.empty());
+}
+
+TEST_CASE("topology")
+{
+    CHECK(coop::cpu_mask_t::parse("0-2,8,10-11\n")
+          == coop::cpu_mask_t{0b1101'0000'0111});
+    CHECK(coop::cpu_mask_t::parse("100-101").count() == 2);
+
+    // Malformed lists are rejected outright rather than partially applied
+    CHECK(coop::cpu_mask_t::parse("0-4294967295").empty());
+    CHECK(coop::cpu_mask_t::parse("0,99999999999").empty());
+    CHECK(coop::cpu_mask_t::parse("3-1").empty());
+    CHECK(coop::cpu_mask_t::parse("0,2-").empty());
+
+    coop::topology_t const& topology = coop::scheduler_t::instance().topology();
+    CHECK(topology.cpu_count() > 0);
+    CHECK(topology.node_count() > 0);
+    for (uint32_t cpu = 0; cpu != topology.cpu_count(); ++cpu)
+    {
+        CHECK(topology.distance(cpu, cpu) == coop::topology_t::distance_e::core);
+        CHECK(topology.cache_mask(cpu).test(cpu));
+        CHECK(topology.node_mask(cpu).test(cpu));
+    }
+
+    // The calling thread is running on one of the available CPUs
+    CHECK(!coop::topology_t::available_cpus().empty());
+}
+
+TEST_CASE("cpu quota")
+{
+    CHECK(coop::topology_t::parse_cpu_max("max 100000\n") == 0);
+    CHECK(coop::topology_t::parse_cpu_max("400000 100000\n") == 4);
+    // Fractional quotas round up
+    CHECK(coop::topology_t::parse_cpu_max("150000 100000\n") == 2);
+    CHECK(coop::topology_t::parse_cpu_max("50000 100000\n") == 1);
+    CHECK(coop::topology_t::parse_cpu_max("1000 100000\n") == 1);
+    CHECK(coop::topology_t::parse_cpu_max("100000 0\n") == 0);
+    CHECK(coop::topology_t::parse_cpu_max("100000\n") == 0);
+    CHECK(coop::topology_t::parse_cpu_max("") == 0);
+
+    CHECK(coop::scheduler_config_t::default_worker_count(8, 0) == 8);
+    CHECK(coop::scheduler_config_t::default_worker_count(8, 2) == 2);
+    CHECK(coop::scheduler_config_t::default_worker_count(8, 16) == 8);
+    CHECK(coop::scheduler_config_t::default_worker_count(0, 0) == 1);
+}
+
+coop::task_t<void, true>
+run_on(coop::scheduler_t& scheduler, std::thread::id& id)
+{
+    COOP_SUSPEND1(scheduler);
+    id = std::this_thread::get_id();
+}
+
+TEST_CASE("configured scheduler")
+{
+    coop::scheduler_config_t config;
+    config.worker_count   = 3;
+    config.pinning        = coop::pinning_e::none;
+    config.queue_capacity = 16;
+    coop::scheduler_t scheduler{config};
+    CHECK(scheduler.worker_count() == 3);
+    CHECK(scheduler.cpu_mask().count() == 3);
+
+    std::thread::id id;
+    run_on(scheduler, id).join();
+    CHECK(id != std::thread::id{});
+    CHECK(id != std::this_thread::get_id());
+}
+
+coop::task_t<void, true> block_worker(coop::scheduler_t& scheduler,
+                                      std::atomic<bool>& started,
+                                      std::atomic<bool>& release,
+                                      coop::cpu_mask_t cpu_mask = {})
+{
+    COOP_SUSPEND2(scheduler, cpu_mask);
+    started = true;
+    while (!release)
+    {
+        std::this_thread::yield();
+    }
+}
+
+coop::task_t<void, true> record_priority(coop::scheduler_t& scheduler,
+                                         uint32_t priority,
+                                         std::vector<uint32_t>& order,
+                                         std::atomic<int>& remaining)
+{
+    co_await coop::suspend(scheduler, {}, priority);
+    order.push_back(priority);
+    --remaining;
+}
+
+TEST_CASE("weighted priorities")
+{
+    coop::scheduler_config_t config;
+    config.worker_count     = 1;
+    config.pinning          = coop::pinning_e::none;
+    config.priority_count   = 3;
+    config.priority_weights = {1, 3, 9};
+    coop::scheduler_t scheduler{config};
+    CHECK(scheduler.priority_count() == 3);
+
+    // Occupy the only worker so that every coroutine below is queued before
+    // any of them run
+    std::atomic<bool> started = false;
+    std::atomic<bool> release = false;
+    block_worker(scheduler, started, release);
+    while (!started)
+    {
+        std::this_thread::yield();
+    }
+
+    std::vector<uint32_t> order;
+    std::atomic<int> remaining = 36;
+    for (uint32_t priority = 0; priority != 3; ++priority)
+    {
+        for (int i = 0; i != 12; ++i)
+        {
+            record_priority(scheduler, priority, order, remaining);
+        }
+    }
+
+    release = true;
+    while (remaining != 0)
+    {
+        std::this_thread::yield();
+    }
+
+    // With strict priorities, priority 1 would only run after all 12 priority
+    // 2 coroutines, and priority 0 after all 24 higher priority coroutines
+    REQUIRE(order.size() == 36);
+    auto first = [&](uint32_t priority) {
+        return std::find(order.begin(), order.end(), priority) - order.begin();
+    };
+    CHECK(order[0] == 2);
+    CHECK(first(1) < 12);
+    CHECK(first(0) < 24);
+}
+
+coop::task_t<void, true> record_deadline(coop::scheduler_t& scheduler,
+                                         int id,
+                                         coop::deadline_t deadline,
+                                         std::vector<int>& order,
+                                         std::atomic<int>& remaining)
+{
+    COOP_SUSPEND_DEADLINE(scheduler, deadline);
+    order.push_back(id);
+    --remaining;
+}
+
+coop::task_t<void, true> record_id(coop::scheduler_t& scheduler,
+                                   int id,
+                                   std::vector<int>& order,
+                                   std::atomic<int>& remaining)
+{
+    COOP_SUSPEND3(scheduler, 0, 1);
+    order.push_back(id);
+    --remaining;
+}
+
+TEST_CASE("deadline scheduling")
+{
+    coop::scheduler_config_t config;
+    config.worker_count = 1;
+    config.pinning      = coop::pinning_e::none;
+    coop::scheduler_t scheduler{config};
+
+    std::atomic<bool> started = false;
+    std::atomic<bool> release = false;
+    block_worker(scheduler, started, release);
+    while (!started)
+    {
+        std::this_thread::yield();
+    }
+
+    // Coroutines scheduled by priority are queued first, but run last
+    std::vector<int> order;
+    std::atomic<int> remaining = 10;
+    record_id(scheduler, -1, order, remaining);
+    record_id(scheduler, -2, order, remaining);
+
+    auto now = std::chrono::steady_clock::now();
+    for (int id : {5, 2, 7, 0, 3, 6, 1, 4})
+    {
+        record_deadline(scheduler,
+                        id,
+                        now + std::chrono::milliseconds{id},
+                        order,
+                        remaining);
+    }
+
+    release = true;
+    while (remaining != 0)
+    {
+        std::this_thread::yield();
+    }
+
+    CHECK(order == std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7, -1, -2});
+}
+
+// A scheduler without deadline support, which runs coroutines immediately
+struct inline_scheduler_t
+{
+    void schedule(std::coroutine_handle<> coroutine,
+                  coop::cpu_mask_t,
+                  uint32_t,
+                  coop::source_location_t)
+    {
+        coroutine.resume();
+    }
+};
+
+coop::task_t<> suspend_inline(inline_scheduler_t& scheduler, bool& done)
+{
+    co_await coop::suspend(scheduler, std::chrono::steady_clock::now());
+    done = true;
+}
+
+TEST_CASE("deadline fallback")
+{
+    inline_scheduler_t scheduler;
+    bool done = false;
+    auto task = suspend_inline(scheduler, done);
+    CHECK(done);
+}
+
+coop::task_t<void, true> record_pinned(coop::scheduler_t& scheduler,
+                                       coop::cpu_mask_t cpu_mask,
+                                       int id,
+                                       std::vector<int>& order,
+                                       std::atomic<int>& remaining)
+{
+    COOP_SUSPEND2(scheduler, cpu_mask);
+    order.push_back(id);
+    --remaining;
+}
+
+coop::task_t<void, true> count_down(coop::scheduler_t& scheduler,
+                                    std::atomic<int>& remaining)
+{
+    COOP_SUSPEND1(scheduler);
+    --remaining;
+}
+
+TEST_CASE("pinned order")
+{
+    coop::scheduler_config_t config;
+    config.worker_count = 4;
+    config.pinning      = coop::pinning_e::none;
+    coop::scheduler_t scheduler{config};
+    coop::cpu_mask_t pinned;
+    pinned.set(scheduler.worker_cpu(0));
+
+    // Queue coroutines pinned to a busy worker, while its idle peers
+    // repeatedly look for work to steal
+    std::atomic<bool> started = false;
+    std::atomic<bool> release = false;
+    block_worker(scheduler, started, release, pinned);
+    while (!started)
+    {
+        std::this_thread::yield();
+    }
+
+    std::vector<int> order;
+    std::atomic<int> remaining = 64;
+    for (int i = 0; i != 64; ++i)
+    {
+        record_pinned(scheduler, pinned, i, order, remaining);
+    }
+
+    std::atomic<int> unpinned = 1000;
+    for (int i = 0; i != 1000; ++i)
+    {
+        count_down(scheduler, unpinned);
+    }
+    while (unpinned != 0)
+    {
+        std::this_thread::yield();
+    }
+
+    release = true;
+    while (remaining != 0)
+    {
+        std::this_thread::yield();
+    }
+
+    // Peers never take pinned coroutines out of the queue, so their order
+    // is preserved
+    REQUIRE(order.size() == 64);
+    CHECK(std::is_sorted(order.begin(), order.end()));
+}
+
+coop::task_t<void, true> sleep_and_record(std::chrono::milliseconds duration,
+                                          std::atomic<int>& early,
+                                          std::atomic<int>& remaining)
+{
+    auto deadline = std::chrono::steady_clock::now() + duration;
+    co_await coop::sleep_for(duration);
+    if (std::chrono::steady_clock::now() < deadline
+        || !coop::detail::work_queue_t::current())
+    {
+        ++early;
+    }
+    --remaining;
+}
+
+TEST_CASE("sleep")
+{
+    // Sleeping coroutines don't occupy workers, so many can sleep at once
+    // regardless of the worker count
+    std::mt19937 rng{0};
+    std::uniform_int_distribution<int> distribution{1, 100};
+    std::atomic<int> early     = 0;
+    std::atomic<int> remaining = 10000;
+    auto start                 = std::chrono::steady_clock::now();
+    for (int i = 0; i != 10000; ++i)
+    {
+        sleep_and_record(
+            std::chrono::milliseconds{distribution(rng)}, early, remaining);
+    }
+
+    while (remaining != 0)
+    {
+        std::this_thread::yield();
+    }
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+    CHECK(early == 0);
+    CHECK(ms >= 100);
+    CHECK(ms < 2000);
+}
+
+struct test_timer_t : coop::detail::timer_node_t
+{
+    coop::deadline_t deadline;
+    coop::deadline_t expired_at;
+    std::atomic<int>* remaining;
+};
+
+TEST_CASE("timing wheel")
+{
+    // A 1 us tick exercises the upper levels of the wheel within the test's
+    // time frame
+    coop::timer_service_t timers{std::chrono::microseconds{1}};
+
+    std::mt19937 rng{0};
+    std::uniform_int_distribution<int> distribution{0, 300'000};
+    std::vector<test_timer_t> nodes(2000);
+    std::atomic<int> remaining = static_cast<int>(nodes.size());
+    auto now                   = std::chrono::steady_clock::now();
+    for (auto& node : nodes)
+    {
+        node.expire = [](coop::detail::timer_node_t* node) {
+            auto& self      = *static_cast<test_timer_t*>(node);
+            self.expired_at = std::chrono::steady_clock::now();
+            --*self.remaining;
+        };
+        node.deadline  = now + std::chrono::microseconds{distribution(rng)};
+        node.remaining = &remaining;
+        timers.add(&node, node.deadline);
+    }
+
+    // Timers far beyond the range of the wheel can be cancelled
+    test_timer_t distant;
+    distant.expire = nodes[0].expire;
+    timers.add(&distant, now + std::chrono::hours{24});
+    CHECK(timers.cancel(&distant));
+    CHECK(!timers.cancel(&distant));
+
+    // Cancel every tenth timer
+    int cancelled = 0;
+    for (size_t i = 0; i < nodes.size(); i += 10)
+    {
+        if (timers.cancel(&nodes[i]))
+        {
+            ++cancelled;
+            --remaining;
+        }
+    }
+    CHECK(cancelled > 0);
+
+    while (remaining != 0)
+    {
+        std::this_thread::yield();
+    }
+    CHECK(timers.size() == 0);
+
+    int early = 0;
+    for (auto& node : nodes)
+    {
+        if (node.expired_at != coop::deadline_t{}
+            && node.expired_at < node.deadline)
+        {
+            ++early;
+        }
+    }
+    CHECK(early == 0);
+}
+
+TEST_CASE("timer wakeup")
+{
+    // With only a distant timer pending, the thread sleeps until that timer's
+    // slot cascades, so adding a nearer timer must wake it early
+    coop::timer_service_t timers;
+    std::atomic<int> remaining = 1;
+    auto expire                = [](coop::detail::timer_node_t* node) {
+        auto& self      = *static_cast<test_timer_t*>(node);
+        self.expired_at = std::chrono::steady_clock::now();
+        --*self.remaining;
+    };
+
+    test_timer_t distant;
+    distant.expire    = expire;
+    distant.remaining = &remaining;
+    timers.add(&distant, std::chrono::steady_clock::now() + std::chrono::hours{1});
+    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+
+    test_timer_t near;
+    near.expire    = expire;
+    near.remaining = &remaining;
+    near.deadline  = std::chrono::steady_clock::now() + std::chrono::milliseconds{20};
+    timers.add(&near, near.deadline);
+
+    while (remaining != 0)
+    {
+        std::this_thread::yield();
+    }
+    CHECK(near.expired_at >= near.deadline);
+    CHECK(near.expired_at - near.deadline < std::chrono::seconds{1});
+    CHECK(timers.size() == 1);
+    CHECK(timers.cancel(&distant));
+}
+
+TEST_CASE("timer cancel during expiry")
+{
+    // Cancelling a timer whose callback is running waits for it to return, so
+    // the node may be destroyed as soon as cancel returns
+    coop::timer_service_t timers;
+    std::atomic<int> remaining = 1;
+    test_timer_t node;
+    node.expire = [](coop::detail::timer_node_t* node) {
+        auto& self = *static_cast<test_timer_t*>(node);
+        --*self.remaining;
+        std::this_thread::sleep_for(std::chrono::milliseconds{50});
+        self.expired_at = std::chrono::steady_clock::now();
+    };
+    node.remaining = &remaining;
+    timers.add(&node, std::chrono::steady_clock::now());
+
+    while (remaining != 0)
+    {
+        std::this_thread::yield();
+    }
+    CHECK(!timers.cancel(&node));
+    CHECK(node.expired_at != coop::deadline_t{});
+}
+
+coop::task_t<int> spawn_tree(int depth)
+{
+    COOP_SUSPEND();
+    if (depth == 0)
+    {
+        co_return 1;
+    }
+
+    // Children spawned from a worker are pushed to its local deque and stolen
+    // by idle peers
+    auto left  = spawn_tree(depth - 1);
+    auto right = spawn_tree(depth - 1);
+    co_return co_await left + co_await right;
+}
+
+coop::task_t<void, true> spawn_tree_root(int& leaves)
+{
+    leaves = co_await spawn_tree(10);
+}
+
+coop::task_t<int>
+arena_tree(std::allocator_arg_t, coop::arena_t& arena, int depth)
+{
+    COOP_SUSPEND();
+    if (depth == 0)
+    {
+        co_return 1;
+    }
+
+    auto left  = arena_tree(std::allocator_arg, arena, depth - 1);
+    auto right = arena_tree(std::allocator_arg, arena, depth - 1);
+    co_return co_await left + co_await right;
+}
+
+coop::task_t<void, true> arena_tree_root(std::allocator_arg_t,
+                                         coop::arena_t& arena,
+                                         int& leaves,
+                                         size_t& size,
+                                         int& other)
+{
+    leaves = co_await arena_tree(std::allocator_arg, arena, 8);
+
+    // Every frame in the tree (including those of coroutines that resumed on
+    // other workers before spawning children) came from the arena
+    size = arena.size();
+
+    // Coroutines not passed the arena don't allocate from it
+    other = co_await spawn_tree(4);
+    CHECK(arena.size() == size);
+}
+
+coop::task_t<void, true>
+arena_background(std::allocator_arg_t, coop::arena_t&, coop::event_t& gate)
+{
+    co_await gate;
+}
+
+TEST_CASE("arena")
+{
+    coop::arena_t arena;
+    int leaves  = 0;
+    size_t size = 0;
+    int other   = 0;
+    arena_tree_root(std::allocator_arg, arena, leaves, size, other).join();
+    CHECK(leaves == 256);
+    CHECK(other == 16);
+    CHECK(size >= 512 * sizeof(coop::detail::frame_header_t));
+    std::printf("Arena size for 512 frames: %zu bytes\n", size);
+
+    // Joining the root doesn't return until its coroutine has dropped its
+    // reference to the frame, so the temporary task freed the last frame,
+    // releasing the arena on this thread. Were any frame still held by a
+    // worker, destroying the arena below would race with it freeing the
+    // frame.
+    CHECK(arena.frames() == 0);
+    CHECK(arena.size() == 0);
+
+    // A frame outliving the root keeps the arena's memory alive until it's
+    // freed too
+    {
+        coop::event_t gate;
+        gate.init();
+        auto background = arena_background(std::allocator_arg, arena, gate);
+        arena_tree_root(std::allocator_arg, arena, leaves, size, other).join();
+        CHECK(leaves == 256);
+        CHECK(arena.size() > 0);
+        CHECK(arena.frames() == 1);
+        gate.signal();
+        background.join();
+        CHECK(arena.frames() == 1);
+    }
+    CHECK(arena.frames() == 0);
+    CHECK(arena.size() == 0);
+}
+
+TEST_CASE("arena allocation")
+{
+    // Allocations from many threads are distinct and aligned, including ones
+    // larger than a block
+    coop::arena_t arena{4096};
+    std::vector<void*> allocations[4];
+    std::vector<std::thread> threads;
+    for (auto& out : allocations)
+    {
+        threads.emplace_back([&arena, &out] {
+            for (size_t i = 0; i != 1000; ++i)
+            {
+                size_t size = i % 100 == 0 ? 10000 : 24 + i % 200;
+                void* p     = arena.allocate(size);
+                std::memset(p, 0xff, size);
+                out.push_back(p);
+            }
+        });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    std::vector<void*> all;
+    for (auto& out : allocations)
+    {
+        all.insert(all.end(), out.begin(), out.end());
+    }
+    std::sort(all.begin(), all.end());
+    CHECK(std::adjacent_find(all.begin(), all.end()) == all.end());
+    CHECK(std::all_of(all.begin(), all.end(), [](void* p) {
+        return reinterpret_cast<uintptr_t>(p) % 16 == 0;
+    }));
+}
+
+TEST_CASE("frame pool")
+{
+    // Frames freed on another thread are reclaimed by the allocating thread
+    // once its own free list is exhausted
+    std::vector<void*> frames;
+    for (int i = 0; i != 100; ++i)
+    {
+        frames.push_back(coop::detail::allocate_frame(2000));
+    }
+    std::thread{[&] {
+        for (void* frame : frames)
+        {
+            coop::detail::deallocate_frame(frame, 2000);
+        }
+    }}.join();
+
+    std::vector<void*> reallocated;
+    for (int i = 0; i != 200; ++i)
+    {
+        reallocated.push_back(coop::detail::allocate_frame(2000));
+    }
+    std::sort(reallocated.begin(), reallocated.end());
+    CHECK(std::all_of(frames.begin(), frames.end(), [&](void* frame) {
+        return std::binary_search(reallocated.begin(), reallocated.end(), frame);
+    }));
+    for (void* frame : reallocated)
+    {
+        coop::detail::deallocate_frame(frame, 2000);
+    }
+
+    // Frames larger than the largest size class bypass the pool
+    void* large = coop::detail::allocate_frame(1 << 20);
+    std::memset(large, 0, 1 << 20);
+    coop::detail::deallocate_frame(large, 1 << 20);
+}
+
+TEST_CASE("recursive spawn")
+{
+    int leaves = 0;
+    spawn_tree_root(leaves).join();
+    CHECK(leaves == 1024);
+}
+
+coop::task_t<int, true> join_value(int value)
+{
+    COOP_SUSPEND();
+    co_return value;
+}
+
+// Records the thread destroying the frame holding it
+struct frame_tracker_t
+{
+    std::thread::id* destroyed_on;
+
+    explicit frame_tracker_t(std::thread::id& destroyed_on)
+        : destroyed_on{&destroyed_on}
+    {
+    }
+
+    frame_tracker_t(frame_tracker_t&& other) noexcept
+        : destroyed_on{std::exchange(other.destroyed_on, nullptr)}
+    {
+    }
+
+    ~frame_tracker_t()
+    {
+        if (destroyed_on)
+        {
+            *destroyed_on = std::this_thread::get_id();
+        }
+    }
+};
+
+coop::task_t<void, true> join_tracked(frame_tracker_t)
+{
+    COOP_SUSPEND();
+}
+
+TEST_CASE("join")
+{
+    // Join tasks both while they're in flight and after they've completed
+    constexpr int count = 1000;
+    std::vector<coop::task_t<int, true>> tasks;
+    tasks.reserve(count);
+    for (int i = 0; i != count; ++i)
+    {
+        tasks.push_back(join_value(i));
+    }
+
+    int sum = 0;
+    for (int i = 0; i != count; ++i)
+    {
+        if (i == count / 2)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds{20});
+        }
+        tasks[i].join();
+        CHECK(tasks[i]);
+        sum += *tasks[i];
+    }
+    CHECK(sum == count * (count - 1) / 2);
+
+    // Dropping the handle of an unfinished task detaches it
+    for (int i = 0; i != count; ++i)
+    {
+        join_value(i);
+    }
+
+    // Once joined, the frame is no longer referenced by the worker, so it's
+    // destroyed (along with its parameters) by the task's handle
+    for (int i = 0; i != 100; ++i)
+    {
+        std::thread::id destroyed_on;
+        join_tracked(frame_tracker_t{destroyed_on}).join();
+        CHECK(destroyed_on == std::this_thread::get_id());
+    }
+}
+
+coop::task_t<> help_child(coop::scheduler_t& scheduler,
+                          std::thread::id joiner,
+                          std::atomic<int>& helped)
+{
+    co_await coop::suspend(scheduler);
+    std::this_thread::sleep_for(std::chrono::milliseconds{2});
+    if (std::this_thread::get_id() == joiner)
+    {
+        ++helped;
+    }
+}
+
+coop::task_t<void, true> help_parent(coop::scheduler_t& scheduler,
+                                     std::thread::id joiner,
+                                     std::atomic<int>& helped)
+{
+    co_await coop::suspend(scheduler);
+    constexpr size_t count = 32;
+    coop::task_t<> children[count];
+    for (size_t i = 0; i != count; ++i)
+    {
+        children[i] = help_child(scheduler, joiner, helped);
+    }
+    for (auto& child : children)
+    {
+        co_await child;
+    }
+}
+
+TEST_CASE("helping join")
+{
+    coop::scheduler_config_t config;
+    config.worker_count = 1;
+    config.pinning      = coop::pinning_e::none;
+    coop::scheduler_t scheduler{config};
+
+    // The lone worker can only run one child at a time, so the joining thread
+    // picks up the rest
+    std::atomic<int> helped = 0;
+    help_parent(scheduler, std::this_thread::get_id(), helped).join(scheduler);
+    CHECK(helped > 0);
+    CHECK(!scheduler.try_run_one());
+}
+
+#if defined(_WIN32) || defined(__linux__)
+#    if defined(__linux__)
+#        include <sys/resource.h>
+#        include <unistd.h>
+#    endif
+
 coop::task_t<void, true> wait_for_event(coop::event_t& event)
 {
     co_await event;
@@ -147,6 +1395,618 @@ TEST_CASE("event completion")
         = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
     std::printf("Duration for event_completion test: %zu ms\n", ms);
 }
+
+TEST_CASE("event reset")
+{
+    // Checking an auto-reset event consumes its signal
+    coop::event_t automatic;
+    automatic.init(false);
+    CHECK(!automatic.is_signaled());
+    automatic.signal();
+    automatic.signal();
+    CHECK(automatic.is_signaled());
+    CHECK(!automatic.is_signaled());
+
+    coop::event_t manual;
+    manual.init(true);
+    manual.signal();
+    CHECK(manual.is_signaled());
+    CHECK(manual.is_signaled());
+    manual.reset();
+    CHECK(!manual.is_signaled());
+
+    coop::event_ref_t events[] = {automatic.ref(), manual.ref()};
+    manual.signal();
+    auto [status, index] = coop::event_ref_t::wait_many(events, 2);
+    CHECK(status == coop::event_ref_t::status_e::normal);
+    CHECK(index == 1);
+    CHECK(manual.wait());
+}
+
+coop::task_t<void, true> count_event(coop::event_t& event,
+                                     std::atomic<int>& remaining)
+{
+    co_await event;
+    --remaining;
+}
+
+TEST_CASE("many events")
+{
+    // More events than the event thread initially has room for
+    std::vector<coop::event_t> events(100);
+    std::atomic<int> remaining = static_cast<int>(events.size());
+    for (auto& event : events)
+    {
+        event.init();
+        count_event(event, remaining);
+    }
+
+    for (auto& event : events)
+    {
+        event.signal();
+    }
+
+    while (remaining != 0)
+    {
+        std::this_thread::yield();
+    }
+    CHECK(remaining == 0);
+}
+
+#    if defined(__linux__)
+TEST_CASE("many event waits")
+{
+    // Waiting on an event consumes no descriptor, so far more coroutines than
+    // the descriptor limit lowered to here can wait at once
+    std::vector<coop::event_t> automatic(100);
+    std::vector<coop::event_t> manual(20);
+    for (auto& event : automatic)
+    {
+        event.init();
+    }
+    for (auto& event : manual)
+    {
+        event.init(true);
+    }
+
+    rlimit limit;
+    REQUIRE(getrlimit(RLIMIT_NOFILE, &limit) == 0);
+    rlimit lowered = limit;
+    int highest    = dup(manual.back().fd());
+    close(highest);
+    lowered.rlim_cur = static_cast<rlim_t>(highest) + 64;
+    REQUIRE(lowered.rlim_cur < 1024);
+    REQUIRE(setrlimit(RLIMIT_NOFILE, &lowered) == 0);
+
+    int waits                  = 100 + 20 * 100;
+    std::atomic<int> remaining = waits;
+    for (auto& event : automatic)
+    {
+        count_event(event, remaining);
+    }
+    for (auto& event : manual)
+    {
+        for (int i = 0; i != 100; ++i)
+        {
+            count_event(event, remaining);
+        }
+    }
+
+    // No coroutine resumes before its event is signaled
+    std::this_thread::sleep_for(std::chrono::milliseconds{20});
+    CHECK(remaining == waits);
+
+    for (auto& event : automatic)
+    {
+        event.signal();
+    }
+    for (auto& event : manual)
+    {
+        event.signal();
+    }
+    while (remaining != 0)
+    {
+        std::this_thread::yield();
+    }
+    CHECK(remaining == 0);
+    setrlimit(RLIMIT_NOFILE, &limit);
+}
+#    endif
+
+TEST_CASE("shared event")
+{
+    // Every coroutine awaiting a manual-reset event resumes once it's
+    // signaled
+    coop::event_t event;
+    event.init(true);
+    std::atomic<int> remaining = 10;
+    for (int i = 0; i != 10; ++i)
+    {
+        count_event(event, remaining);
+    }
+
+    event.signal();
+    while (remaining != 0)
+    {
+        std::this_thread::yield();
+    }
+    CHECK(remaining == 0);
+}
+#endif
+
+#if defined(__linux__)
+#    include <arpa/inet.h>
+#    include <netinet/in.h>
+#    include <sys/socket.h>
+#    include <unistd.h>
+
+coop::task_t<void, true> copy_block(int fd,
+                                    uint32_t block,
+                                    std::atomic<int>& remaining,
+                                    std::atomic<int>& failures)
+{
+    // Write a block of the file and read it back into a separate buffer
+    uint32_t data[256];
+    for (uint32_t i = 0; i != 256; ++i)
+    {
+        data[i] = block * 256 + i;
+    }
+    uint64_t offset = block * sizeof(data);
+    if (co_await coop::write(fd, data, sizeof(data), offset) != sizeof(data))
+    {
+        ++failures;
+    }
+
+    uint32_t copy[256] = {};
+    if (co_await coop::read(fd, copy, sizeof(copy), offset) != sizeof(copy)
+        || !std::equal(data, data + 256, copy))
+    {
+        ++failures;
+    }
+    --remaining;
+}
+
+coop::task_t<void, true> read_block(int fd,
+                                    uint32_t (&buffer)[256],
+                                    uint64_t offset,
+                                    ssize_t& result,
+                                    std::atomic<int>& remaining)
+{
+    result = co_await coop::read(fd, buffer, sizeof(buffer), offset);
+    --remaining;
+}
+
+TEST_CASE("file io")
+{
+    char path[] = "/tmp/coop_io_XXXXXX";
+    int fd      = mkstemp(path);
+    REQUIRE(fd >= 0);
+    unlink(path);
+
+    std::atomic<int> remaining = 1000;
+    std::atomic<int> failures  = 0;
+    for (uint32_t block = 0; block != 1000; ++block)
+    {
+        copy_block(fd, block, remaining, failures);
+    }
+
+    while (remaining != 0)
+    {
+        std::this_thread::yield();
+    }
+    CHECK(failures == 0);
+
+    // Reads past the end of the file are short, and errors are reported as
+    // negated errno values
+    uint32_t buffer[256];
+    ssize_t eof;
+    ssize_t error;
+    remaining = 2;
+    read_block(fd, buffer, 1000 * sizeof(buffer), eof, remaining);
+    read_block(-1, buffer, 0, error, remaining);
+    while (remaining != 0)
+    {
+        std::this_thread::yield();
+    }
+    CHECK(eof == 0);
+    CHECK(error == -EBADF);
+    close(fd);
+}
+
+coop::task_t<void, true> copy_fixed_block(int fd,
+                                          uint32_t block,
+                                          std::atomic<int>& remaining,
+                                          std::atomic<int>& failures)
+{
+    // Leasing happens on a worker, so buffers cycle through its free list
+    COOP_SUSPEND();
+    coop::io_buffer_t buffer = coop::io_service_t::instance().lease_buffer();
+    if (!buffer)
+    {
+        ++failures;
+        --remaining;
+        co_return;
+    }
+
+    auto* data = static_cast<uint32_t*>(buffer.data());
+    for (uint32_t i = 0; i != 256; ++i)
+    {
+        data[i] = block * 256 + i;
+    }
+    uint64_t offset = block * 1024;
+    if (co_await coop::write(fd, buffer, 1024, offset) != 1024)
+    {
+        ++failures;
+    }
+
+    std::memset(data, 0, 1024);
+    if (co_await coop::read(fd, buffer, 1024, offset) != 1024)
+    {
+        ++failures;
+    }
+    for (uint32_t i = 0; i != 256; ++i)
+    {
+        if (data[i] != block * 256 + i)
+        {
+            ++failures;
+            break;
+        }
+    }
+    --remaining;
+}
+
+TEST_CASE("registered buffers")
+{
+    char path[] = "/tmp/coop_io_XXXXXX";
+    int fd      = mkstemp(path);
+    REQUIRE(fd >= 0);
+    unlink(path);
+
+    // A pool larger than the address space can't be allocated, and leaves
+    // nothing behind so registration can be retried
+    coop::io_service_t& io_service = coop::io_service_t::instance();
+    CHECK(!io_service.register_buffers(1u << 30, 1u << 20));
+    REQUIRE(io_service.register_buffers(1024, 64));
+    CHECK(io_service.buffer_size() % 1024 == 0);
+    std::printf("Registered buffers: %s\n",
+                io_service.buffers_registered() ? "fixed" : "unregistered");
+
+    // Leased buffers are distinct, and the pool is exhausted once every
+    // buffer is leased
+    std::vector<coop::io_buffer_t> leased;
+    while (auto buffer = io_service.lease_buffer())
+    {
+        leased.push_back(std::move(buffer));
+    }
+    CHECK(leased.size() >= 64);
+    std::sort(leased.begin(), leased.end(), [](auto& lhs, auto& rhs) {
+        return lhs.data() < rhs.data();
+    });
+    CHECK(std::adjacent_find(
+              leased.begin(),
+              leased.end(),
+              [](auto& lhs, auto& rhs) { return lhs.data() == rhs.data(); })
+          == leased.end());
+    size_t leased_count = leased.size();
+    leased.clear();
+
+    // More blocks than buffers, so buffers are reused. Fewer blocks than half
+    // the pool are in flight at once, so leasing never fails.
+    std::atomic<int> remaining;
+    std::atomic<int> failures = 0;
+    for (uint32_t wave = 0; wave != 16; ++wave)
+    {
+        remaining = 32;
+        for (uint32_t block = wave * 32; block != (wave + 1) * 32; ++block)
+        {
+            copy_fixed_block(fd, block, remaining, failures);
+        }
+        while (remaining != 0)
+        {
+            std::this_thread::yield();
+        }
+    }
+    CHECK(failures == 0);
+    close(fd);
+
+    // Every buffer was returned to the pool or a worker's free list, and
+    // workers cache at most half of the pool
+    std::atomic<size_t> count = 0;
+    remaining                 = 1;
+    [](std::atomic<size_t>& count,
+       std::atomic<int>& remaining) -> coop::task_t<void, true> {
+        COOP_SUSPEND();
+        std::vector<coop::io_buffer_t> leased;
+        while (auto buffer = coop::io_service_t::instance().lease_buffer())
+        {
+            leased.push_back(std::move(buffer));
+        }
+        count = leased.size();
+        --remaining;
+    }(count, remaining);
+    while (remaining != 0)
+    {
+        std::this_thread::yield();
+    }
+    CHECK(count >= leased_count / 2);
+}
+
+TEST_CASE("file io fallback")
+{
+    char path[] = "/tmp/coop_io_XXXXXX";
+    int fd      = mkstemp(path);
+    REQUIRE(fd >= 0);
+    unlink(path);
+
+    coop::io_service_t io_service{256, false};
+    CHECK(!io_service.uses_io_uring());
+
+    struct op_t : coop::detail::io_op_t
+    {
+        std::atomic<bool> done = false;
+    };
+
+    char message[] = "coop";
+    op_t op;
+    op.opcode   = coop::detail::io_op_t::opcode_e::write;
+    op.fd       = fd;
+    op.buffer   = message;
+    op.size     = sizeof(message);
+    op.complete = [](coop::detail::io_op_t* op) {
+        static_cast<op_t*>(op)->done = true;
+    };
+    io_service.submit(&op);
+    while (!op.done)
+    {
+        std::this_thread::yield();
+    }
+    CHECK(op.result == sizeof(message));
+
+    char copy[sizeof(message)] = {};
+    op.done   = false;
+    op.opcode = coop::detail::io_op_t::opcode_e::read;
+    op.buffer = copy;
+    io_service.submit(&op);
+    while (!op.done)
+    {
+        std::this_thread::yield();
+    }
+    CHECK(op.result == sizeof(message));
+    CHECK(std::string{copy} == "coop");
+    close(fd);
+}
+
+coop::task_t<void, true> send_all(int socket,
+                                  std::vector<char> const& data,
+                                  std::atomic<int>& remaining)
+{
+    size_t sent = 0;
+    while (sent != data.size())
+    {
+        ssize_t result
+            = co_await coop::send(socket, data.data() + sent, data.size() - sent);
+        if (result <= 0)
+        {
+            break;
+        }
+        sent += static_cast<size_t>(result);
+    }
+    --remaining;
+}
+
+coop::task_t<void, true> recv_all(int socket,
+                                  std::vector<char>& data,
+                                  std::atomic<int>& remaining)
+{
+    char buffer[4096];
+    while (true)
+    {
+        ssize_t result = co_await coop::recv(socket, buffer, sizeof(buffer));
+        if (result <= 0)
+        {
+            break;
+        }
+        data.insert(data.end(), buffer, buffer + result);
+    }
+    --remaining;
+}
+
+TEST_CASE("socket transfer")
+{
+    int sockets[2];
+    REQUIRE(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) == 0);
+
+    // Far more than the socket buffers hold, so both sides wait on the
+    // reactor repeatedly
+    std::vector<char> sent(8 << 20);
+    std::mt19937 generator{0};
+    for (char& c : sent)
+    {
+        c = static_cast<char>(generator());
+    }
+    std::vector<char> received;
+
+    std::atomic<int> remaining = 2;
+    recv_all(sockets[1], received, remaining);
+    send_all(sockets[0], sent, remaining);
+    while (remaining != 1)
+    {
+        std::this_thread::yield();
+    }
+
+    // Receiving finishes once the sending side shuts down
+    shutdown(sockets[0], SHUT_WR);
+    while (remaining != 0)
+    {
+        std::this_thread::yield();
+    }
+    CHECK(received == sent);
+    close(sockets[0]);
+    close(sockets[1]);
+}
+
+TEST_CASE("socket duplex")
+{
+    int sockets[2];
+    REQUIRE(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) == 0);
+
+    // Each socket sends and receives at once, so a coroutine waiting to
+    // receive on a socket doesn't hold up another waiting to send on it
+    std::vector<char> sent(4 << 20);
+    std::mt19937 generator{0};
+    for (char& c : sent)
+    {
+        c = static_cast<char>(generator());
+    }
+    std::vector<char> received[2];
+
+    std::atomic<int> remaining = 4;
+    recv_all(sockets[0], received[0], remaining);
+    recv_all(sockets[1], received[1], remaining);
+    send_all(sockets[0], sent, remaining);
+    send_all(sockets[1], sent, remaining);
+    while (remaining != 2)
+    {
+        std::this_thread::yield();
+    }
+
+    shutdown(sockets[0], SHUT_WR);
+    shutdown(sockets[1], SHUT_WR);
+    while (remaining != 0)
+    {
+        std::this_thread::yield();
+    }
+    CHECK(received[0] == sent);
+    CHECK(received[1] == sent);
+    close(sockets[0]);
+    close(sockets[1]);
+}
+
+coop::task_t<void, true> recv_byte(int socket, std::atomic<int>& remaining)
+{
+    char byte;
+    if (co_await coop::recv(socket, &byte, 1) == 1)
+    {
+        --remaining;
+    }
+}
+
+TEST_CASE("idle sockets")
+{
+    // Waiting on a socket consumes no descriptor, so every connection can
+    // wait at once with the descriptor limit lowered to just above those
+    // already open
+    std::vector<std::pair<int, int>> connections(300);
+    for (auto& [first, second] : connections)
+    {
+        int sockets[2];
+        REQUIRE(
+            socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) == 0);
+        first  = sockets[0];
+        second = sockets[1];
+    }
+
+    rlimit limit;
+    REQUIRE(getrlimit(RLIMIT_NOFILE, &limit) == 0);
+    rlimit lowered   = limit;
+    lowered.rlim_cur = static_cast<rlim_t>(connections.back().second) + 16;
+    REQUIRE(setrlimit(RLIMIT_NOFILE, &lowered) == 0);
+
+    int count                  = static_cast<int>(connections.size());
+    std::atomic<int> remaining = count;
+    for (auto& connection : connections)
+    {
+        recv_byte(connection.second, remaining);
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds{20});
+    CHECK(remaining == count);
+
+    for (auto& connection : connections)
+    {
+        CHECK(::send(connection.first, "x", 1, 0) == 1);
+    }
+    while (remaining != 0)
+    {
+        std::this_thread::yield();
+    }
+    CHECK(remaining == 0);
+
+    setrlimit(RLIMIT_NOFILE, &limit);
+    for (auto& [first, second] : connections)
+    {
+        close(first);
+        close(second);
+    }
+}
+
+coop::task_t<void, true> echo_connections(int listener,
+                                          int count,
+                                          std::atomic<int>& remaining)
+{
+    for (int i = 0; i != count; ++i)
+    {
+        int connection = static_cast<int>(co_await coop::accept(listener));
+        if (connection < 0)
+        {
+            break;
+        }
+
+        // Echo a single message back on each connection
+        [](int connection) -> coop::task_t<void, true> {
+            char buffer[64];
+            ssize_t size = co_await coop::recv(connection, buffer, sizeof(buffer));
+            if (size > 0)
+            {
+                co_await coop::send(connection, buffer, static_cast<size_t>(size));
+            }
+            close(connection);
+        }(connection);
+    }
+    --remaining;
+}
+
+TEST_CASE("socket accept")
+{
+    int listener
+        = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    REQUIRE(listener >= 0);
+    sockaddr_in address{};
+    address.sin_family      = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length        = sizeof(address);
+    REQUIRE(bind(listener, reinterpret_cast<sockaddr*>(&address), length) == 0);
+    REQUIRE(listen(listener, 16) == 0);
+    getsockname(listener, reinterpret_cast<sockaddr*>(&address), &length);
+
+    std::atomic<int> remaining = 1;
+    echo_connections(listener, 8, remaining);
+
+    // Connect with blocking sockets from this thread
+    for (int i = 0; i != 8; ++i)
+    {
+        // Give the acceptor a chance to wait on the reactor
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+
+        int client = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        REQUIRE(
+            connect(client, reinterpret_cast<sockaddr*>(&address), length) == 0);
+        std::string message = "hello " + std::to_string(i);
+        CHECK(::send(client, message.data(), message.size(), 0)
+              == static_cast<ssize_t>(message.size()));
+
+        char buffer[64];
+        ssize_t size = ::recv(client, buffer, sizeof(buffer), 0);
+        CHECK(std::string(buffer, size > 0 ? size : 0) == message);
+        close(client);
+    }
+
+    while (remaining != 0)
+    {
+        std::this_thread::yield();
+    }
+    close(listener);
+}
 #endif
 
 int main(int argc, char* argv[])